@@ -0,0 +1,45 @@
+/* In-process R binding of libnucovid.so (see src/NUCOVID_api.h), used by
+ * run_covid_age_lib() in covid_age_wrapper.R.  Build it next to the library:
+ *
+ *     make -C ../exp/chicago_yr1 lib
+ *     R CMD SHLIB nucovid_r.c -I../src -L../exp/chicago_yr1 -lnucovid -Wl,-rpath,$(realpath ../exp/chicago_yr1)
+ */
+
+#include <string.h>
+#include <R.h>
+#include <Rinternals.h>
+#include "NUCOVID_api.h"
+
+/* Run the simulation params_json (the model binary's JSON parameters) for
+ * its duration and return its daily output as a named list of numeric
+ * columns. */
+SEXP nucovid_r_run(SEXP params_json) {
+    char msg[512];
+    nucovid_sim* sim;
+    size_t rows;
+    int c;
+    SEXP out, names;
+
+    if (!isString(params_json) || LENGTH(params_json) != 1) error("params_json must be a single string");
+    sim = nucovid_create(CHAR(STRING_ELT(params_json, 0)));
+    if (sim == NULL || nucovid_run(sim, nucovid_duration(sim)) != 0) {
+        /* error() does not return, so copy the message and free first */
+        strncpy(msg, nucovid_last_error(), sizeof(msg) - 1);
+        msg[sizeof(msg) - 1] = '\0';
+        if (sim != NULL) nucovid_destroy(sim);
+        error("nucovid: %s", msg);
+    }
+    rows = nucovid_rows(sim);
+    PROTECT(out = allocVector(VECSXP, NUCOVID_COLUMNS));
+    PROTECT(names = allocVector(STRSXP, NUCOVID_COLUMNS));
+    for (c = 0; c < NUCOVID_COLUMNS; c++) {
+        SEXP col = allocVector(REALSXP, rows);
+        SET_VECTOR_ELT(out, c, col);
+        nucovid_column(sim, c, REAL(col));
+        SET_STRING_ELT(names, c, mkChar(nucovid_column_name(c)));
+    }
+    setAttrib(out, R_NamesSymbol, names);
+    nucovid_destroy(sim);
+    UNPROTECT(2);
+    return out;
+}
@@ -0,0 +1,56 @@
+// Microbenchmark: target node selection from an infection_matrix row by
+// linear scan (the previous get_infection_node_id) vs. an AliasTable, and
+// rand_nonuniform_int() on a vector vs. on an AliasTable, across node counts.
+#include <chrono>
+#include "Utility.h"
+
+size_t linear_scan(const vector<double>& row, mt19937& rng) {
+    double total_weight = 0.0;
+    size_t chosen = row.size() - 1;
+    for (size_t i = 0; i < row.size(); i++) { total_weight += row[i]; }
+    double r = rand_uniform(0, total_weight, &rng);
+    for (size_t i = 0; i < row.size(); i++) {
+        if (r < row[i]) {
+            chosen = i;
+            break;
+        } else {
+            r -= row[i];
+        }
+    }
+    return chosen;
+}
+
+template<typename F>
+double ns_per_draw(size_t draws, F f) {
+    auto start = std::chrono::steady_clock::now();
+    size_t checksum = 0;
+    for (size_t i = 0; i < draws; i++) checksum += f();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (checksum == 1) cerr << "";    // keep the loop from being optimized away
+    return 1e9 * secs / draws;
+}
+
+int main(int argc, char* argv[]) {
+    size_t draws = argc > 1 ? std::stoul(argv[1]) : 2000000;
+    mt19937 rng(1);
+
+    cout << "nodes\tlinear_ns\talias_ns\tnonuniform_ns\tnonuniform_alias_ns\tbuild_us" << endl;
+    for (size_t n = 2; n <= 4096; n *= 2) {
+        vector<double> row(n);
+        for (size_t i = 0; i < n; i++) row[i] = rand_uniform(0, 1, &rng);
+        vector<double> normed = normalize_dist(row);
+
+        auto start = std::chrono::steady_clock::now();
+        AliasTable table(row);
+        double build_us = 1e6 * std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        double linear = ns_per_draw(draws, [&]() { return linear_scan(row, rng); });
+        double alias = ns_per_draw(draws, [&]() { return table.sample(&rng); });
+        double nonuni = ns_per_draw(draws, [&]() { return rand_nonuniform_int(normed, &rng); });
+        double nonuni_alias = ns_per_draw(draws, [&]() { return rand_nonuniform_int(table, &rng); });
+
+        cout << n << "\t" << setprecision(4) << linear << "\t" << alias << "\t"
+             << nonuni << "\t" << nonuni_alias << "\t" << build_us << endl;
+    }
+    return 0;
+}
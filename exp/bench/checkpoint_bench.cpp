@@ -0,0 +1,77 @@
+// Size and save/load time of the flat checkpoint format (NUCOVID_checkpoint.h)
+// against the cereal archive, for one simulation checkpointed at several
+// days.  Load times are from the page cache.
+#include <chrono>
+#include <cereal/archives/binary.hpp>
+#include "NUCOVID_checkpoint.h"
+
+shared_ptr<Node> make_node() {
+    vector<double> Ki(400, 1.0522);
+    for (size_t d = 37; d < Ki.size(); d++) Ki[d] = 0.1 * 1.0522;
+    vector<vector<double>> Krec(400, {1.0/9.0, 1.0/9.0, 1/5.78538, 1.0/9.671261, 1.0/2.194643});
+    vector<vector<double>> Pdetect(400, {0.05, 0.1, 0.2, 0.8});
+    return make_shared<Node>(0, 2500000, Ki, 0.4066/3.677037, 0.5934/3.677037, 0.921/3.409656, 0.079/3.409656,
+                             1.0/4.076704, 1.0/5.592791, 1.0/5.459323, Krec, vector<double>(400, 0.4),
+                             vector<double>(400, 0.5), Pdetect, 0.8, 0.00733, vector<double>{2, 2, 2});
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+size_t file_size(const string& fname) {
+    struct stat buf;
+    return stat(fname.c_str(), &buf) == 0 ? buf.st_size : 0;
+}
+
+int main(int argc, char* argv[]) {
+    string dir = argc > 1 ? argv[1] : "/tmp";
+    string flat = dir + "/checkpoint_bench.flat";
+    string arch = dir + "/checkpoint_bench.cereal";
+
+    Event_Driven_NUCOVID sim({make_node()}, {{1}});
+    sim.reseed(1);
+    sim.Now = 9;
+    sim.rand_infect(10, sim.nodes[0]);
+
+    stringstream table;
+    table << "day\tevents\tflat_MB\tflat_save_ms\tflat_load_ms\tcereal_MB\tcereal_save_ms\tcereal_load_ms" << endl;
+    table << fixed << setprecision(2);
+    const int days[] = {30, 45, 60, 90, 120, 180, 270, 370};
+    for (int day : days) {
+        sim.run_simulation(day - sim.Now, {}, false);
+
+        auto start = std::chrono::steady_clock::now();
+        save_checkpoint(sim, flat);
+        double flat_save = seconds_since(start);
+        start = std::chrono::steady_clock::now();
+        {
+            Event_Driven_NUCOVID copy;
+            load_checkpoint(copy, flat);
+        }
+        double flat_load = seconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        {
+            ofstream file(arch, ios::binary);
+            cereal::BinaryOutputArchive oarchive(file);
+            oarchive(sim);
+        }
+        double arch_save = seconds_since(start);
+        start = std::chrono::steady_clock::now();
+        {
+            Event_Driven_NUCOVID copy;
+            ifstream file(arch, ios::binary);
+            cereal::BinaryInputArchive iarchive(file);
+            iarchive(copy);
+        }
+        double arch_load = seconds_since(start);
+
+        table << day << "\t" << sim.EventQ.size() << "\t" << file_size(flat) / 1e6 << "\t" << flat_save * 1e3 << "\t"
+              << flat_load * 1e3 << "\t" << file_size(arch) / 1e6 << "\t" << arch_save * 1e3 << "\t" << arch_load * 1e3 << endl;
+    }
+    remove(flat.c_str());
+    remove(arch.c_str());
+    cout << table.str();
+    return 0;
+}
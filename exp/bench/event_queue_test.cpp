@@ -0,0 +1,117 @@
+// Checks of the event queue backends (Event_Queue.h): bulk pushes into an
+// empty queue, including of 0 and 1 events, pop in time order, and
+// interleaved pushes and pops as a simulation makes them pop the same
+// sequence from every backend.  Exits non-zero if any check fails.
+#include <random>
+#include "Event_Queue.h"
+
+struct TestEvent {
+    double time;
+    int id;
+};
+
+struct LaterFirst {
+    bool operator()(const TestEvent& a, const TestEvent& b) const {
+        return a.time > b.time or (a.time == b.time and a.id > b.id);
+    }
+};
+
+// bulk-push n events into an empty queue of type qtype and pop them all
+bool check_bulk(queueType qtype, size_t n) {
+    mt19937 rng(n);
+    uniform_real_distribution<double> runif(0, 100);
+    vector<TestEvent> batch;
+    for (size_t i = 0; i < n; i++) batch.push_back(TestEvent{runif(rng), (int) i});
+    EventScheduler<TestEvent, LaterFirst> q;
+    q.set_type(qtype);
+    q.push_bulk(batch);
+    if (q.size() != n) return false;
+    double last = -1;
+    while (not q.empty()) {
+        TestEvent e = q.pop();
+        if (e.time < last) return false;
+        last = e.time;
+    }
+    return true;
+}
+
+// Pushes and pops as a simulation makes them, the same for every backend
+// given the same seed: events at the time of the last one popped, at or
+// before the current earliest one, between them and far beyond the
+// calendar queue's ring, on a grid of quarter days so that times tie,
+// pushed one at a time and in batches.  The events in the order popped.
+vector<TestEvent> interleaved(queueType qtype, unsigned seed) {
+    mt19937 rng(seed);
+    uniform_int_distribution<int> action(0, 9);
+    uniform_int_distribution<int> quarters(0, 40);
+    EventScheduler<TestEvent, LaterFirst> q;
+    q.set_type(qtype);
+    vector<TestEvent> popped;
+    double now = 0;
+    int id = 0;
+    auto draw = [&]() {
+        double t;
+        switch (action(rng) % 5) {
+            case 0:  t = now; break;                                            // tie with the last popped
+            case 1:  t = q.empty() ? now : q.top().time; break;                 // tie with the earliest
+            case 2:  t = q.empty() ? now : now + (q.top().time - now) / 2; break; // before the earliest
+            case 3:  t = now + 2000 + quarters(rng); break;                     // beyond the ring
+            default: t = now + quarters(rng) / 4.0;
+        }
+        return TestEvent{t, id++};
+    };
+    for (int step = 0; step < 20000; step++) {
+        const int a = action(rng);
+        if (a < 4) {
+            q.push(draw());
+        } else if (a < 5) {
+            vector<TestEvent> batch(quarters(rng) % 8);
+            for (auto& e : batch) e = draw();
+            q.push_bulk(batch);
+        } else if (not q.empty()) {
+            popped.push_back(q.pop());
+            now = popped.back().time;
+        }
+    }
+    while (not q.empty()) popped.push_back(q.pop());
+    return popped;
+}
+
+// every backend pops what the binary heap pops, in time order
+bool check_interleaved(queueType qtype, unsigned seed) {
+    const vector<TestEvent> expected = interleaved(BINARY_HEAP, seed);
+    for (size_t i = 1; i < expected.size(); i++) {
+        if (LaterFirst()(expected[i - 1], expected[i])) return false;
+    }
+    const vector<TestEvent> got = interleaved(qtype, seed);
+    if (got.size() != expected.size()) return false;
+    for (size_t i = 0; i < got.size(); i++) {
+        if (got[i].time != expected[i].time or got[i].id != expected[i].id) return false;
+    }
+    return true;
+}
+
+int main() {
+    const char* names[] = {"binary", "dary", "calendar", "radix"};
+    const queueType types[] = {BINARY_HEAP, DARY_HEAP, CALENDAR_QUEUE, RADIX_HEAP};
+    int failures = 0;
+    for (int t = 0; t < 4; t++) {
+        for (size_t n : {0, 1, 2, 5, 1000}) {
+            if (not check_bulk(types[t], n)) {
+                cerr << "FAILED: bulk push of " << n << " events into an empty " << names[t] << " queue" << endl;
+                failures++;
+            }
+        }
+    }
+    for (int t = 0; t < 4; t++) {
+        for (unsigned seed = 1; seed <= 5; seed++) {
+            if (not check_interleaved(types[t], seed)) {
+                cerr << "FAILED: interleaved pushes and pops, seed " << seed << ", on a " << names[t]
+                     << " queue" << endl;
+                failures++;
+            }
+        }
+    }
+    if (failures == 0) cout << "event queue checks passed" << endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,46 @@
+// Throughput of MeanField_NUCOVID: parameter sets per second for a batch of
+// one-node models split into blocks of different sizes, integration alone
+// and including print_state() style formatting.
+#include <chrono>
+#include "NUCOVID_ode.h"
+
+shared_ptr<Node> make_node(double ini_Ki) {
+    vector<double> Ki(400, ini_Ki);
+    for (size_t d = 30; d < Ki.size(); d++) Ki[d] = 0.1 * ini_Ki;
+    vector<vector<double>> Krec(400, {1.0/9.0, 1.0/9.0, 1/5.78538, 1.0/9.671261, 1.0/2.194643});
+    vector<vector<double>> Pdetect(400, {0.05, 0.1, 0.2, 0.8});
+    return make_shared<Node>(0, 2500000, Ki, 0.4066/3.677037, 0.5934/3.677037, 0.921/3.409656, 0.079/3.409656,
+                             1.0/4.076704, 1.0/5.592791, 1.0/5.459323, Krec, vector<double>(400, 0.4),
+                             vector<double>(400, 0.5), Pdetect, 0.8, 0.00733, vector<double>{2, 2, 2});
+}
+
+int main(int argc, char* argv[]) {
+    size_t nsets = argc > 1 ? std::stoul(argv[1]) : 2048;
+    int steps = argc > 2 ? std::stoi(argv[2]) : 2;
+    vector<vector<shared_ptr<Node>>> sets;
+    for (size_t b = 0; b < nsets; b++) sets.push_back({make_node(1.0 + 0.0001 * b)});
+    vector<vector<double>> mat = {{1}};
+
+    cout << "block\tsets_per_sec\tsets_per_sec_with_output\tR_day_370\trows_per_set" << endl;
+    for (size_t block = 1; block <= nsets; block *= 4) {
+        double integrate_secs = 0, output_secs = 0, check = 0;
+        size_t rows = 0;
+        for (size_t first = 0; first < nsets; first += block) {
+            vector<vector<shared_ptr<Node>>> part(sets.begin() + first, sets.begin() + min(first + block, nsets));
+            auto start = std::chrono::steady_clock::now();
+            MeanField_NUCOVID ode(part, mat, steps);
+            ode.Now = 9;
+            ode.infect(0, 10);
+            ode.integrate_days(362);
+            auto mid = std::chrono::steady_clock::now();
+            for (size_t b = 0; b < part.size(); b++) rows += ode.daily_output(b).size();
+            auto end = std::chrono::steady_clock::now();
+            integrate_secs += std::chrono::duration<double>(mid - start).count();
+            output_secs += std::chrono::duration<double>(end - mid).count();
+            if (first == 0) check = ode.daily[(361*MFO_COLS + MFO_R)*part.size()];
+        }
+        cout << block << "\t" << fixed << setprecision(1) << nsets / integrate_secs << "\t"
+             << nsets / (integrate_secs + output_secs) << "\t" << check << "\t" << rows / nsets << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,240 @@
+#include <memory>
+#include <mutex>
+#include "chicago_yr1.h"
+#include "Work_Stealing_Pool.h"
+#include "Daily_Output.h"
+#include "MPI_Dispatch.h"
+
+// Ensembles over MPI (make mpi; mpirun -np <ranks> ./model_mpi '<json>').
+// Takes the model's parameters, of which serials is required: replicates
+// [first, last] of params, or of each entry of params["batch"] (parameter
+// overrides), in units of params["mpi_chunk"] replicates that rank 0 hands
+// out to the other ranks as they ask for work.  Each rank runs its units on
+// params["threads"] threads, and replicates get the same random_seeds as in
+// the model's own serials ensembles, so the outputs hold the same rows.
+//
+// The daily output of each replicate goes back to rank 0, which writes one
+// file per parameter set (text or binary, output_filename numbered as for
+// batch); the summaries of summary_file are gathered on each rank and
+// merged on rank 0.  Nothing is written anywhere but on rank 0, and
+// nothing at all if any replicate fails: each unit's result carries the
+// number of its replicates that failed, and rank 0 then fails the run.
+
+struct Unit {
+    size_t set;         // index into the parameter sets
+    int first;
+    int last;
+};
+
+// one parameter set's share of the output, on rank 0
+struct SetOutput {
+    unique_ptr<StreamWriter> text;
+    vector<DailyState> daily;       // binary output
+    vector<int> daily_serials;
+};
+
+int ensemble(const nlohmann::json& params) {
+    const int rank = mpi_rank();
+    const int nranks = mpi_size();
+
+    vector<nlohmann::json> sets;
+    if (params["batch"] == nullptr) {
+        sets.push_back(params);
+    } else {
+        for (auto& overrides : params["batch"]) {
+            nlohmann::json p;
+            if (apply_overrides(params, overrides, "batch", p) != 0) return -1;
+            sets.push_back(p);
+        }
+    }
+    const bool batch = params["batch"] != nullptr;
+    const int first = params["serials"][0];
+    const int last = params["serials"][1];
+    const unsigned nthreads = params["threads"];
+    const int chunk = params["mpi_chunk"];
+
+    vector<Unit> units;
+    for (size_t b = 0; b < sets.size(); b++) {
+        for (int s = first; s <= last; s += chunk) units.push_back(Unit{b, s, min(s + chunk - 1, last)});
+    }
+
+    const bool summarize = params["summary_file"] != nullptr;
+    const bool daily_output = not (summarize and params["summary_only"]);
+    const bool binary = params["output_format"] == "binary";
+    vector<DailySummary> summaries(sets.size(), DailySummary(params["summary_sketch_k"].get<int>()));
+    vector<vector<shared_ptr<Node>>> base_nodes(sets.size());    // built when a set is first needed
+    vector<std::map<double, int>> seeds(sets.size());
+
+    string out_fname = params["output_directory"].get<string>() + "/" + params["output_filename"].get<string>();
+    vector<SetOutput> outputs(rank == 0 ? sets.size() : 0);
+    if (rank == 0 and daily_output and not binary) {
+        for (size_t b = 0; b < sets.size(); b++) {
+            outputs[b].text.reset(new StreamWriter(batch ? numbered_fname(out_fname, b) : out_fname, true,
+                                                   params["output_buffer_bytes"]));
+            outputs[b].text->write("serial\t" + daily_header());
+        }
+    }
+
+    auto work = [&](size_t u) {
+        const Unit& unit = units[u];
+        const nlohmann::json& p = sets[unit.set];
+        if (base_nodes[unit.set].empty()) {
+            base_nodes[unit.set] = initialize_1node(p);
+            for (auto d : p["random_seeds"]) seeds[unit.set].emplace(d[0].get<double>(), d[1]);
+        }
+        mutex m;
+        vector<DailyState> rows;
+        vector<int> serials;
+        int failed = 0;
+        parallel_for_stealing(unit.last - unit.first + 1, nthreads, [&](size_t k, unsigned) {
+            const int serial = unit.first + k;
+            vector<DailyState> rep_daily;
+            const bool ok = run_replicate(p, base_nodes[unit.set], seeds[unit.set], serial, NULL, &rep_daily) == 0;
+            lock_guard<mutex> lock(m);
+            if (not ok) {
+                std::cerr << "ERROR: replicate " << serial << " of parameter set " << unit.set << " failed" << std::endl;
+                failed++;
+                return;
+            }
+            if (summarize) summaries[unit.set].add(rep_daily);
+            if (daily_output) {
+                rows.insert(rows.end(), rep_daily.begin(), rep_daily.end());
+                serials.insert(serials.end(), rep_daily.size(), serial);
+            }
+        });
+        if (failed > 0) {
+            rows.clear();
+            serials.clear();
+        }
+        return to_bytes(failed, rows, serials);
+    };
+
+    int failed = 0;     // replicates, on rank 0
+    auto collect = [&](size_t u, const string& result) {
+        int unit_failed;
+        vector<DailyState> rows;
+        vector<int> serials;
+        from_bytes(result, unit_failed, rows, serials);
+        failed += unit_failed;
+        if (failed > 0) return;
+        SetOutput& out = outputs[units[u].set];
+        if (out.text) {
+            for (size_t r = 0; r < rows.size(); r++) out.text->write(to_string(serials[r]) + "\t" + daily_line(rows[r]));
+        } else if (daily_output) {
+            out.daily.insert(out.daily.end(), rows.begin(), rows.end());
+            out.daily_serials.insert(out.daily_serials.end(), serials.begin(), serials.end());
+        }
+    };
+
+    auto wall_start = std::chrono::steady_clock::now();
+    mpi_dispatch(units.size(), work, collect);
+
+    int status = 0;
+    if (rank == 0 and failed > 0) {
+        for (SetOutput& out : outputs) {
+            if (out.text) out.text->discard();
+        }
+        std::cerr << "ERROR: " << failed << " replicates failed, no output written" << std::endl;
+        status = -1;
+    }
+    if (summarize) {
+        vector<string> parts = mpi_gather_bytes(to_bytes(summaries));
+        if (rank == 0 and status == 0) {
+            vector<DailySummary> merged(sets.size(), DailySummary(params["summary_sketch_k"].get<int>()));
+            for (const string& part : parts) {
+                vector<DailySummary> rank_summaries;
+                from_bytes(part, rank_summaries);
+                for (size_t b = 0; b < sets.size(); b++) merged[b].merge(rank_summaries[b]);
+            }
+            const vector<double> quantiles = params["summary_quantiles"].get<vector<double>>();
+            const string summary_fname = params["summary_file"];
+            for (size_t b = 0; b < sets.size(); b++) {
+                if (not merged[b].write(batch ? numbered_fname(summary_fname, b) : summary_fname, quantiles)) status = -1;
+            }
+        }
+    }
+    if (rank != 0 or status != 0) return status;
+
+    for (size_t b = 0; b < sets.size(); b++) {
+        const string fname = batch ? numbered_fname(out_fname, b) : out_fname;
+        if (outputs[b].text and not outputs[b].text->close()) status = -1;
+        if (daily_output and binary and not write_daily_binary(outputs[b].daily, fname, sets[b].dump(), &outputs[b].daily_serials)) {
+            status = -1;
+        }
+    }
+    const size_t replicates = sets.size() * (last - first + 1);
+    double wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    std::cout << "ranks, replicates, wall time, replicates/sec: " << nranks << ", " << replicates << ", " << wall_time
+              << ", " << (wall_time > 0 ? replicates / wall_time : 0) << std::endl;
+    return status;
+}
+
+// the parameters of a run, as rank 0 read them, or -1
+int read_params(int argc, char* argv[], nlohmann::json& params) {
+    UserProvided upr;
+    load_default_params(params);
+    params["mpi_chunk"] = 16;       // replicates per unit of work
+    if (argc > 2) {
+        std::cerr << "usage: mpirun -np <ranks> model_mpi [json map formatted parameters]" << std::endl;
+        return -1;
+    }
+    if (argc == 2 and parse_params(params, argv[1], upr) != 0) return -1;
+    if (params["serials"] == nullptr) {
+        std::cerr << "model_mpi needs serials" << std::endl;
+        return -1;
+    }
+    for (const char* key : {"branches", "serve", "result_cache", "abc_priors", "filter_observed",
+                            "precision_targets"}) {
+        if (params[key] != nullptr) {
+            std::cerr << "model_mpi does not support " << key << std::endl;
+            return -1;
+        }
+    }
+    if (stop_rules(params)) {
+        std::cerr << "model_mpi does not support stop_extinct, stop_cumu_adm or condition_on_takeoff" << std::endl;
+        return -1;
+    }
+    if (params["output_format"] != "text" and params["output_format"] != "binary") {
+        std::cerr << "Invalid output_format: " << params["output_format"] << " (text or binary)" << std::endl;
+        return -1;
+    }
+    if (not params["mpi_chunk"].is_number_integer() or params["mpi_chunk"] < 1) {
+        std::cerr << "Invalid mpi_chunk: " << params["mpi_chunk"] << " (positive integer)" << std::endl;
+        return -1;
+    }
+    if (check_ensemble(params) != 0) return -1;
+    if (params["batch"] != nullptr) {
+        if (not params["batch"].is_array()) {
+            std::cerr << "Invalid batch: " << params["batch"] << " (list of parameter overrides)" << std::endl;
+            return -1;
+        }
+        for (auto& overrides : params["batch"]) {
+            nlohmann::json p;
+            if (apply_overrides(params, overrides, "batch", p) != 0) return -1;
+            if (check_ensemble(p) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    MPI_Init(&argc, &argv);
+    nlohmann::json params;
+    string params_json;
+    int ok = 1;
+    if (mpi_rank() == 0) {
+        ok = read_params(argc, argv, params) == 0;
+        params_json = params.dump();    // random_seeds as rank 0 drew them
+    }
+    MPI_Bcast(&ok, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (not ok) {
+        MPI_Finalize();
+        return -1;
+    }
+    mpi_broadcast_bytes(params_json);
+    params = nlohmann::json::parse(params_json);
+    if (mpi_rank() != 0) cout.rdbuf(NULL);      // one rank reports progress
+    const int status = ensemble(params);
+    MPI_Finalize();
+    return status;
+}
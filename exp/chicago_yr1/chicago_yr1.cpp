@@ -1,16 +1,19 @@
 #include <ostream>
 
+#include "chicago_yr1.h"
 #include "Time_Series.h"
-#include "NUCOVID_cereal.h"
-#include "json.hpp"
-
-struct UserProvided {
-    bool kaysmp, kmild, frac_as, frac_det, ini_ki, ki_ap;
-
-    UserProvided() : kaysmp(false), kmild(false), frac_as(false), frac_det(false), 
-                     ini_ki(false), ki_ap(false) {}
-
-};
+#include "NUCOVID_tau_leap.h"
+#include "NUCOVID_ode.h"
+#include "NUCOVID_next_reaction.h"
+#include "Work_Stealing_Pool.h"
+#include "Result_Cache.h"
+#include "NDJSON_Server.h"
+#include "Daily_Output.h"
+#include "ABC_SMC.h"
+#include "Particle_Filter.h"
+#include "Ensemble_Precision.h"
+#include <atomic>
+#include <condition_variable>
 
 vector<vector<double>> transpose2dVector( vector<vector<double>> vec2d ) {
     vector<vector<double>> tvec2d;
@@ -181,22 +184,1090 @@ void update_node(shared_ptr<Node>& node, const nlohmann::json& params, UserProvi
     if (upr.frac_as) node->frac_infectiousness_As = new_node->frac_infectiousness_As;
     if (upr.frac_det) node->frac_infectiousness_det = new_node->frac_infectiousness_det;
     if (upr.ki_ap || upr.ini_ki) node->Ki = new_node->Ki;
+    node->build_day_params(node->days());
+}
+
+// select the event queue backend, if one was requested
+int set_event_queue(Event_Driven_NUCOVID& sim, const nlohmann::json& params) {
+    auto qname = params["event_queue"];
+    if (qname == nullptr) return 0;
+    queueType qtype;
+    if (not parse_queue_type(qname.get<string>(), qtype)) {
+        std::cerr << "Invalid event_queue: " << qname << " (binary, dary, calendar or radix)" << std::endl;
+        return -1;
+    }
+    sim.EventQ.set_type(qtype);
+    return 0;
+}
+
+// "mt19937" or "philox" for per-event counter-based streams; null keeps
+// sim's, which is mt19937 for a new one
+int set_rng(Event_Driven_NUCOVID& sim, const nlohmann::json& params) {
+    if (params["rng"] == nullptr) return 0;
+    string rng_name = params["rng"];
+    if (rng_name == "philox") {
+        sim.counter_rng = true;
+    } else if (rng_name == "mt19937") {
+        sim.counter_rng = false;
+    } else {
+        std::cerr << "Invalid rng: " << rng_name << " (mt19937 or philox)" << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+// "exact" (default), "hybrid", which tau-leaps while the epidemic is large,
+// or "next_reaction", which needs sim.aggregate_contacts from the start
+int run_engine(Event_Driven_NUCOVID& sim, double duration, const std::map<double, int>& seeds,
+               const nlohmann::json& params, vector<string>& out_buffer) {
+    string engine = params["engine"];
+    if (engine == "exact") {
+        out_buffer = sim.run_simulation(duration, seeds, false);
+    } else if (engine == "hybrid") {
+        TauLeap_NUCOVID tl(sim, params["tau_steps_per_day"], params["tau_leap_above"], params["tau_exact_below"]);
+        out_buffer = tl.run_simulation(duration, seeds, false);
+    } else if (engine == "next_reaction") {
+        NextReaction_NUCOVID nr(sim);
+        out_buffer = nr.run_simulation(duration, seeds, false);
+    } else {
+        std::cerr << "Invalid engine: " << engine << " (exact, hybrid, next_reaction or ode)" << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+// A restored sim keeps the checkpoint's generator and where its stream
+// is, unless "rng" or a time 0 seed other than -1 is given (upr).
+int continue_rng(Event_Driven_NUCOVID& sim, const nlohmann::json& params, const UserProvided& upr) {
+    if (set_rng(sim, params) != 0) return -1;
+    if (not upr.random_seeds) return 0;
+    for (const auto& d : params["random_seeds"]) {
+        if (d[0] == 0 and d[1] != -1) sim.reseed(d[1]);
+    }
+    return 0;
+}
+
+// Seed a new simulation at SEED_DAY
+int seed_from_scratch(Event_Driven_NUCOVID& sim, const std::map<double, int>& seeds, const nlohmann::json& params) {
+    sim.lazy_contacts = params["lazy_contacts"];
+    sim.aggregate_contacts = params["engine"] == "next_reaction";
+    if (set_event_queue(sim, params) != 0) return -1;
+    if (set_rng(sim, params) != 0) return -1;
+
+    auto iter = seeds.find(0);
+    if (iter == seeds.end()) {
+        std::cout << "Aborting. Please provide an initial time 0 random seed" << std::endl;
+        return -1;
+    }
+    sim.reseed(iter->second);
+    sim.Now = SEED_DAY;
+    sim.rand_infect(10, sim.nodes[0]);//*2
+    return 0;
+}
+
+// Seed a new simulation at SEED_DAY and run it to params["duration"]
+int run_from_scratch(Event_Driven_NUCOVID& sim, const std::map<double, int>& seeds,
+                     const nlohmann::json& params, vector<string>& out_buffer) {
+    if (seed_from_scratch(sim, seeds, params) != 0) return -1;
+    double duration = params["duration"].get<double>() - sim.Now;
+    return run_engine(sim, duration, seeds, params, out_buffer);
+}
+
+// whether params set any stop rule, which also marks the output with a
+// "stopped" column
+bool stop_rules(const nlohmann::json& params) {
+    return params["stop_extinct"] == true or params["stop_cumu_adm"] != nullptr or params["condition_on_takeoff"] == true;
 }
 
-void checkpoint(const string& fname, Event_Driven_NUCOVID& sim) {
+int check_stop_rules(const nlohmann::json& params) {
+    if (not stop_rules(params)) return 0;
+    for (const char* key : {"branches", "checkpoint_store", "abc_priors", "filter_observed"}) {
+        if (params[key] != nullptr) {
+            std::cerr << "Stop rules do not support " << key << std::endl;
+            return -1;
+        }
+    }
+    if (params["engine"] == "ode" or params["restore_from"] != nullptr) {
+        std::cerr << "Stop rules do not support the ode engine or restore_from" << std::endl;
+        return -1;
+    }
+    if (params["condition_on_takeoff"] == true and params["save_at"] != nullptr) {
+        std::cerr << "condition_on_takeoff does not support save_at" << std::endl;
+        return -1;
+    }
+    if (params["stop_cumu_adm"] != nullptr) {
+        bool valid = params["stop_cumu_adm"].is_array();
+        for (const auto& b : params["stop_cumu_adm"]) {
+            valid = valid and b.is_array() and b.size() == 3 and b[0].is_number_integer();
+            valid = valid and (b[1].is_number() or b[1] == nullptr) and (b[2].is_number() or b[2] == nullptr);
+        }
+        if (not valid) {
+            std::cerr << "Invalid stop_cumu_adm: " << params["stop_cumu_adm"] << " ([[day, low, high], ...])" << std::endl;
+            return -1;
+        }
+    }
+    if (not params["takeoff_cumu_sym"].is_number() or not params["takeoff_max_restarts"].is_number_integer()) {
+        std::cerr << "Invalid takeoff_cumu_sym or takeoff_max_restarts" << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+// End sim's runs as params' stop rules say, at day boundaries: once
+// nobody is exposed or infectious (stop_extinct, or before it has taken off
+// with condition_on_takeoff), and once cumu_adm is out of the bounds of
+// stop_cumu_adm.  Sets report.stopped and report.stop_day, and took_off
+// once cumu_sym reaches takeoff_cumu_sym.
+void set_stop_rules(Event_Driven_NUCOVID& sim, const nlohmann::json& params, RunReport& report, bool& took_off) {
+    const bool extinct = params["stop_extinct"];
+    const bool takeoff = params["condition_on_takeoff"];
+    const double takeoff_cumu_sym = params["takeoff_cumu_sym"];
+    std::map<int, pair<double, double>> adm_bounds;
+    for (const auto& b : params["stop_cumu_adm"]) {
+        adm_bounds[b[0]] = make_pair(b[1] == nullptr ? -INFINITY : b[1].get<double>(),
+                                     b[2] == nullptr ? INFINITY : b[2].get<double>());
+    }
+    report.stopped = RAN_TO_END;
+    took_off = false;
+    sim.day_check = [extinct, takeoff, takeoff_cumu_sym, adm_bounds, &report, &took_off]
+                    (int day, const vector<DailyState>& rows) {
+        double active = 0, cumu_sym = 0, cumu_adm = 0;
+        for (const DailyState& ds : rows) {
+            // contacts go on through hospital and critical care, up to recovery or death
+            active += ds.counts[DS_E] + ds.counts[DS_AP] + ds.counts[DS_SYM] + ds.counts[DS_HOS] + ds.counts[DS_CRIT];
+            cumu_sym += ds.counts[DS_CUMU_SYM];
+            cumu_adm += ds.counts[DS_CUMU_ADM];
+        }
+        if (cumu_sym >= takeoff_cumu_sym) took_off = true;
+        report.stop_day = day;
+        auto bounds = adm_bounds.find(day);
+        if (active == 0 and (extinct or (takeoff and not took_off))) {
+            report.stopped = STOP_EXTINCT;
+        } else if (bounds != adm_bounds.end() and (cumu_adm < bounds->second.first or cumu_adm > bounds->second.second)) {
+            report.stopped = STOP_CUMU_ADM;
+        } else {
+            return true;
+        }
+        return false;
+    };
+}
+
+// run_from_scratch() under params' stop rules, if any.  With
+// condition_on_takeoff, runs that die out (or end) before taking off start
+// over from scratch, their seeds derived from seeds and the number of the
+// attempt, up to takeoff_max_restarts times.
+int run_stopping(Event_Driven_NUCOVID& sim, const std::map<double, int>& seeds, const nlohmann::json& params,
+                 vector<string>& out_buffer, RunReport& report) {
+    report = RunReport();
+    if (not stop_rules(params)) return run_from_scratch(sim, seeds, params, out_buffer);
+    const double duration = params["duration"];
+    const int max_restarts = params["takeoff_max_restarts"];
+    const size_t recorded = sim.record_daily ? sim.record_daily->size() : 0;
+    std::map<double, int> attempt_seeds = seeds;
+    while (true) {
+        bool took_off;
+        set_stop_rules(sim, params, report, took_off);
+        if (run_from_scratch(sim, attempt_seeds, params, out_buffer) != 0) return -1;
+        // died out first, or got to the end without taking off
+        const bool failed = not took_off and report.stopped != STOP_CUMU_ADM;
+        if (not params["condition_on_takeoff"] or not failed) break;
+        if (report.restarts == max_restarts) {
+            std::cerr << "WARNING: run did not take off in " << max_restarts << " restarts" << std::endl;
+            break;
+        }
+        // start over
+        report.restarts++;
+        report.days_restarted += report.stop_day - SEED_DAY;
+        for (const auto& s : seeds) {
+            attempt_seeds[s.first] = s.second == -1 ? -1 : replicate_seed(s.second, (uint64_t) report.restarts << 32);
+        }
+        sim.reset();
+        if (sim.record_daily) sim.record_daily->resize(recorded);
+    }
+    sim.day_check = nullptr;
+    if (report.stopped != RAN_TO_END) report.days_not_run = duration - report.stop_day;
+    return 0;
+}
+
+// append the "stopped" column to the text output of a run (header first)
+void mark_stopped(vector<string>& out_buffer, int stopped) {
+    if (out_buffer.empty()) return;
+    out_buffer[0] += "\tstopped";
+    for (size_t l = 1; l < out_buffer.size(); l++) out_buffer[l] += "\t" + to_string(stopped);
+}
+
+// params["checkpoint_format"]: "flat" (NUCOVID_checkpoint.h) or "cereal"
+int checkpoint(const string& fname, Event_Driven_NUCOVID& sim, const nlohmann::json& params) {
     cout << "Checkpointing to " << fname  << endl;
+    if (params["checkpoint_format"] != "cereal") return save_checkpoint(sim, fname);
     ofstream file(fname, ios::binary);
-    cereal::BinaryOutputArchive oarchive( file );
-    oarchive(sim);
+    try {
+        if (not file) throw cereal::Exception("could not open the file");
+        cereal::BinaryOutputArchive oarchive( file );
+        oarchive(sim);
+        file.close();
+        if (not file) throw cereal::Exception("could not write the file");
+    } catch (const cereal::Exception& e) {
+        cerr << "ERROR: Could not checkpoint to " << fname << ": " << e.what() << endl;
+        return -1;
+    }
+    return 0;
 }
 
+// params["save_at"] = [[day, file], ...]: checkpoints of the exact engine at
+// those days, saved by writer while the run goes on
+int schedule_checkpoints(Event_Driven_NUCOVID& sim, const nlohmann::json& params, CheckpointWriter& writer) {
+    std::map<int, string> files;
+    for (auto d : params["save_at"]) {
+        if (not d.is_array() or d.size() != 2 or not d[0].is_number() or not d[1].is_string()) {
+            std::cerr << "Invalid save_at entry: " << d << " ([day, file])" << std::endl;
+            return -1;
+        }
+        files[d[0].get<int>()] = d[1].get<string>();
+        sim.snapshot_days.insert(d[0].get<int>());
+    }
+    sim.snapshot = [files, &writer](int day, Event_Driven_NUCOVID& state) { writer.add(state, files.at(day)); };
+    return 0;
+}
 
-void runsim (const nlohmann::json& params, UserProvided& upr) {
-    cout << "Running Sim" << endl;
-    if (params["print_params"]) {
-        for (auto& el : params.items()) {
-            std::cout << el.key() << " : " << el.value() << std::endl;
+// either format, told apart by the flat format's magic number
+int restore(const string& fname, Event_Driven_NUCOVID& sim) {
+    cout << "Deserializing " << fname << endl;
+    if (is_flat_checkpoint(fname)) return load_checkpoint(sim, fname);
+    ifstream file(fname, ios::binary);
+    try {
+        cereal::BinaryInputArchive iarchive(file);
+        iarchive(sim);
+    } catch (const cereal::Exception& e) {
+        cerr << "ERROR: Could not restore " << fname << ": " << e.what() << endl;
+        return -1;
+    }
+    return 0;
+}
+
+
+// p = params with overrides applied; keys must already exist, except reserved
+int apply_overrides(const nlohmann::json& params, const nlohmann::json& overrides, const string& reserved,
+                    nlohmann::json& p) {
+    p = params;
+    for (auto& el : overrides.items()) {
+        if (!p.contains(el.key()) or el.key() == reserved) {
+            std::cerr << "Invalid " << reserved << " parameter: " + el.key() << std::endl;
+            return -1;
+        }
+        p[el.key()] = el.value();
+    }
+    return 0;
+}
+
+// daily_output.txt -> daily_output_0.txt, daily_output_1.txt, ...
+string numbered_fname(const string& fname, size_t i) {
+    size_t dot = fname.find_last_of('.');
+    if (dot == string::npos or (fname.find_last_of('/') != string::npos and dot < fname.find_last_of('/'))) dot = fname.size();
+    return fname.substr(0, dot) + "_" + to_string(i) + fname.substr(dot);
+}
+
+// daily output of each parameter set (a node list) with the ode engine,
+// seeded at SEED_DAY like run_from_scratch()
+vector<vector<string>> ode_outputs(const vector<vector<shared_ptr<Node>>>& sets, const nlohmann::json& params) {
+    vector<vector<double>> infection_matrix = {{1}};
+    vector<vector<string>> out;
+    for (size_t first = 0; first < sets.size(); first += MF_BLOCK) {
+        vector<vector<shared_ptr<Node>>> block(sets.begin() + first, sets.begin() + min(first + MF_BLOCK, sets.size()));
+        MeanField_NUCOVID ode(block, infection_matrix, params["ode_steps_per_day"]);
+        ode.Now = SEED_DAY;
+        ode.infect(0, 10);
+        vector<vector<string>> block_out = ode.run_simulation(params["duration"].get<double>() - ode.Now);
+        out.insert(out.end(), block_out.begin(), block_out.end());
+    }
+    return out;
+}
+
+// Expected trajectories for params["batch"], a list of parameter overrides
+// (or just params if there is none), one output file per entry.
+int run_ode(const nlohmann::json& params) {
+    if (params["restore_from"] != nullptr or params["save_to"] != nullptr) {
+        std::cerr << "The ode engine does not support restore_from or save_to" << std::endl;
+        return -1;
+    }
+    nlohmann::json batch = params["batch"];
+    if (batch == nullptr) batch = nlohmann::json::array({nlohmann::json::object()});
+
+    vector<vector<shared_ptr<Node>>> sets;
+    for (auto& overrides : batch) {
+        nlohmann::json p;
+        if (apply_overrides(params, overrides, "batch", p) != 0) return -1;
+        sets.push_back(initialize_1node(p));
+    }
+
+    auto wall_start = std::chrono::steady_clock::now();
+    vector<vector<string>> out = ode_outputs(sets, params);
+    double wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    std::cout << "parameter sets, wall time, sets/sec: " << sets.size() << ", " << wall_time << ", "
+              << (wall_time > 0 ? sets.size() / wall_time : 0) << std::endl;
+
+    string out_fname = params["output_directory"].get<string>()+ "/" + params["output_filename"].get<string>();
+    if (params["batch"] == nullptr) return write_buffer(out[0], out_fname, true) ? 0 : -1;
+    for (size_t b = 0; b < out.size(); b++) {
+        if (not write_buffer(out[b], numbered_fname(out_fname, b), true)) return -1;
+    }
+    return 0;
+}
+
+// Writes the daily output of finished replicates, each line prefixed with
+// its serial, from one thread; replicates appear in the order they finish.
+class EnsembleWriter {
+        StreamWriter file;
+        mutex m;
+        condition_variable ready;
+        deque<pair<int, vector<string>>> finished;
+        bool closing;
+        thread writer;
+
+        void write_loop() {
+            unique_lock<mutex> lock(m);
+            while (true) {
+                ready.wait(lock, [this] { return closing or not finished.empty(); });
+                if (finished.empty()) return;
+                pair<int, vector<string>> rep = std::move(finished.front());
+                finished.pop_front();
+                lock.unlock();
+                string prefix = to_string(rep.first) + "\t";
+                for (size_t l = 1; l < rep.second.size(); l++) file.write(prefix + rep.second[l]);   // skip the header
+                lock.lock();
+            }
+        }
+
+    public:
+        EnsembleWriter(const string& fname, const string& header, size_t buffer_bytes) :
+            file(fname, true, buffer_bytes), closing(false) {
+            file.write("serial\t" + header);
+            writer = thread(&EnsembleWriter::write_loop, this);
+        }
+
+        void add(int serial, vector<string>& out_buffer) {
+            lock_guard<mutex> lock(m);
+            finished.push_back(make_pair(serial, vector<string>()));
+            finished.back().second.swap(out_buffer);
+            ready.notify_one();
+        }
+
+        bool close() {
+            {
+                lock_guard<mutex> lock(m);
+                closing = true;
+            }
+            ready.notify_one();
+            writer.join();
+            return file.close();
+        }
+
+        // stop writing and drop the output
+        void discard() {
+            {
+                lock_guard<mutex> lock(m);
+                closing = true;
+                finished.clear();
+            }
+            ready.notify_one();
+            writer.join();
+            file.discard();
+        }
+};
+
+// Checks the parameters of an ensemble (see run_ensemble()) once, rather
+// than from every replicate.
+int check_ensemble(const nlohmann::json& params) {
+    if (params["restore_from"] != nullptr or params["save_to"] != nullptr or params["save_at"] != nullptr
+            or params["checkpoint_store"] != nullptr) {
+        std::cerr << "Ensemble runs do not support restore_from, save_to, save_at or checkpoint_store" << std::endl;
+        return -1;
+    }
+    auto serials = params["serials"];
+    if (not serials.is_array() or serials.size() != 2 or serials[1] < serials[0]) {
+        std::cerr << "Invalid serials: " << serials << " ([first, last])" << std::endl;
+        return -1;
+    }
+    string engine = params["engine"];
+    if (engine != "exact" and engine != "hybrid" and engine != "next_reaction") {
+        std::cerr << "Invalid engine for an ensemble: " << engine << " (exact, hybrid or next_reaction)" << std::endl;
+        return -1;
+    }
+    Event_Driven_NUCOVID check;
+    if (set_event_queue(check, params) != 0 or set_rng(check, params) != 0) return -1;
+    if (params["summary_file"] != nullptr) {
+        const nlohmann::json& qs = params["summary_quantiles"];
+        bool valid = qs.is_array() and not qs.empty();
+        for (const auto& q : qs) valid = valid and q.is_number() and q >= 0 and q <= 1;
+        if (not valid) {
+            std::cerr << "Invalid summary_quantiles: " << qs << " (list of probabilities)" << std::endl;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Replicate serial of an ensemble: a run from scratch of a copy of
+// base_nodes, with random_seeds derived from seeds and serial, under the
+// stop rules of params.  The daily output goes to out_buffer as text and to
+// daily as numbers, if given, and how the run ended to report.
+int run_replicate(const nlohmann::json& params, const vector<shared_ptr<Node>>& base_nodes,
+                  const std::map<double, int>& seeds, int serial, vector<string>* out_buffer, vector<DailyState>* daily,
+                  RunReport* report) {
+    std::map<double, int> rep_seeds;
+    for (const auto& s : seeds) rep_seeds[s.first] = s.second == -1 ? -1 : replicate_seed(s.second, serial);
+    vector<shared_ptr<Node>> nodes;
+    for (const auto& n : base_nodes) nodes.push_back(make_shared<Node>(*n));
+    vector<vector<double>> infection_matrix = {{1}};
+    Event_Driven_NUCOVID sim(nodes, infection_matrix);
+    sim.record_daily = daily;
+    sim.format_text = out_buffer != NULL;
+    vector<string> no_text;
+    RunReport own;
+    if (not report) report = &own;
+    if (run_stopping(sim, rep_seeds, params, out_buffer ? *out_buffer : no_text, *report) != 0) return -1;
+    if (out_buffer and stop_rules(params)) mark_stopped(*out_buffer, report->stopped);
+    return 0;
+}
+
+// Whether the intervals of the first n values of each of targets are
+// narrow enough, reporting them; never before min_n values.
+bool precision_met(const vector<PrecisionTarget>& targets, const vector<vector<double>>& values, int n, int min_n) {
+    bool met = n >= min_n;
+    std::cout << "replicates: " << n;
+    for (size_t t = 0; t < targets.size(); t++) {
+        vector<double> vs(values[t].begin(), values[t].begin() + n);
+        double estimate, low, high;
+        targets[t].interval(vs, estimate, low, high);
+        met = met and targets[t].met(estimate, low, high);
+        std::cout << "; " << targets[t].name() << ": " << estimate << " [" << low << ", " << high << "], width "
+                  << high - low;
+    }
+    std::cout << (met ? " (met)" : "") << std::endl;
+    return met;
+}
+
+// Replicates params["serials"] = [first, last] of the same parameters on
+// params["threads"] threads (0: one per core), in one process.  Each
+// replicate's random_seeds are derived from the given ones and its serial,
+// and all of them go to out_fname with a leading serial column.  Binary
+// output is kept as numbers until the last replicate is done.  With
+// params["summary_file"], quantiles across the replicates are gathered as
+// they finish and written there, and with params["summary_only"] that is
+// all the output.  With params["precision_targets"] (see PrecisionTarget),
+// replicates run in batches of params["precision_batch"] serials, from
+// first on, until the intervals of all the targets are narrow enough, with
+// at least params["precision_min_replicates"] done, or last is done; as the batches are of the same serials whatever the
+// threads, so is where the ensemble stops.  If any replicate fails, no
+// further batches run, the output is dropped and the ensemble fails.
+int run_ensemble(const nlohmann::json& params, const std::map<double, int>& seeds, const string& out_fname) {
+    if (check_ensemble(params) != 0) return -1;
+    const int first = params["serials"][0];
+    const int last = params["serials"][1];
+    const unsigned nthreads = params["threads"];
+    vector<PrecisionTarget> targets;
+    if (params["precision_targets"] != nullptr) {
+        if (read_precision_targets(params, targets) != 0) return -1;
+        if (not params["precision_batch"].is_number_integer() or params["precision_batch"] < 1) {
+            std::cerr << "Invalid precision_batch: " << params["precision_batch"] << " (positive integer)" << std::endl;
+            return -1;
+        }
+        if (not params["precision_min_replicates"].is_number_integer() or params["precision_min_replicates"] < 1) {
+            std::cerr << "Invalid precision_min_replicates: " << params["precision_min_replicates"]
+                      << " (positive integer)" << std::endl;
+            return -1;
+        }
+    }
+    const int batch_size = targets.empty() ? last - first + 1 : params["precision_batch"].get<int>();
+    const int min_replicates = targets.empty() ? 0 : params["precision_min_replicates"].get<int>();
+    vector<vector<double>> target_values(targets.size(), vector<double>(last - first + 1, NAN));  // by serial
+
+    // node tables are built once and copied into each replicate
+    vector<shared_ptr<Node>> base_nodes = initialize_1node(params);
+
+    const bool summarize = params["summary_file"] != nullptr;
+    const bool daily_output = not (summarize and params["summary_only"]);
+    vector<double> quantiles;
+    if (summarize) quantiles = params["summary_quantiles"].get<vector<double>>();
+    DailySummary summary(params["summary_sketch_k"].get<int>());
+
+    const bool binary = params["output_format"] == "binary";
+    const bool marked = stop_rules(params);
+    unique_ptr<EnsembleWriter> writer;
+    if (daily_output and not binary) {
+        writer.reset(new EnsembleWriter(out_fname, daily_header() + (marked ? "\tstopped" : ""), params["output_buffer_bytes"]));
+    }
+    mutex daily_m;
+    vector<DailyState> daily;
+    vector<int> daily_serials;
+    vector<int> daily_stopped;
+    RunReport total;            // of the stop rules, over the replicates
+    int n_stopped = 0;
+    atomic<int> failed(0);      // replicates
+    auto wall_start = std::chrono::steady_clock::now();
+    int done = first - 1;       // serials up to this one have run
+    bool converged = false;
+    while (done < last and not converged and failed == 0) {
+        const int batch_first = done + 1;
+        done = min(last, done + batch_size);
+        parallel_for_stealing(done - batch_first + 1, nthreads, [&](size_t k, unsigned) {
+            const int serial = batch_first + k;
+            vector<string> out_buffer;
+            vector<DailyState> rep_daily;
+            RunReport report;
+            if (failed > 0) return;
+            if (run_replicate(params, base_nodes, seeds, serial, writer ? &out_buffer : NULL,
+                              binary or summarize or not targets.empty() ? &rep_daily : NULL, &report) != 0) {
+                std::cerr << "ERROR: replicate " << serial << " failed" << std::endl;
+                failed++;
+                return;
+            }
+            if (writer) writer->add(serial, out_buffer);
+            lock_guard<mutex> lock(daily_m);
+            for (size_t t = 0; t < targets.size(); t++) target_values[t][serial - first] = targets[t].value(rep_daily);
+            if (report.stopped != RAN_TO_END) n_stopped++;
+            total.restarts += report.restarts;
+            total.days_not_run += report.days_not_run;
+            total.days_restarted += report.days_restarted;
+            if (summarize) summary.add(rep_daily);
+            if (daily_output and binary) {
+                daily.insert(daily.end(), rep_daily.begin(), rep_daily.end());
+                daily_serials.insert(daily_serials.end(), rep_daily.size(), serial);
+                daily_stopped.insert(daily_stopped.end(), rep_daily.size(), report.stopped);
+            }
+        });
+        if (not targets.empty() and failed == 0) {
+            converged = precision_met(targets, target_values, done - first + 1, min_replicates);
+        }
+    }
+    if (failed > 0) {
+        if (writer) writer->discard();
+        std::cerr << "ERROR: ensemble failed, no output written to " << out_fname << std::endl;
+        return -1;
+    }
+    if (not targets.empty() and not converged) {
+        std::cerr << "WARNING: precision_targets not met by serials " << first << " to " << last << std::endl;
+    }
+    if (daily_output and binary and
+            not write_daily_binary(daily, out_fname, params.dump(), &daily_serials, marked ? &daily_stopped : NULL)) {
+        return -1;
+    }
+    if (writer and not writer->close()) return -1;
+    if (summarize and not summary.write(params["summary_file"], quantiles)) return -1;
+    double wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    std::cout << "replicates, wall time, replicates/sec: " << done - first + 1 << ", " << wall_time << ", "
+              << (wall_time > 0 ? (done - first + 1) / wall_time : 0) << std::endl;
+    if (marked) {
+        std::cout << "stopped early, restarts, days not run, days run by restarted attempts: " << n_stopped << ", "
+                  << total.restarts << ", " << total.days_not_run << ", " << total.days_restarted << std::endl;
+    }
+    return 0;
+}
+
+// Distance of a run of p from scratch to observed, counting the days it
+// ran in days; INFINITY as soon as it is over epsilon.  The run ends at the
+// last observed day.
+double abc_distance(const nlohmann::json& p, const std::map<double, int>& seeds, const ObservedSeries& observed,
+                    double epsilon, uint64_t& days) {
+    Event_Driven_NUCOVID sim(initialize_1node(p), {{1}});
+    sim.format_text = false;
+    double squared = 0;
+    bool rejected = false;
+    sim.day_check = [&](int day, const vector<DailyState>& rows) {
+        days++;
+        squared += observed.squared_distance(day, rows);
+        rejected = squared > epsilon * epsilon;
+        return not rejected and day < observed.last_day();
+    };
+    vector<string> out_buffer;
+    if (run_from_scratch(sim, seeds, p, out_buffer) != 0 or rejected) return INFINITY;
+    return sqrt(squared);
+}
+
+// ABC-SMC calibration of the parameters params["abc_priors"] = {"name":
+// [low, high], ...}, with uniform priors, to params["abc_observed"] (see
+// ObservedSeries) at the Euclidean distance over its days and columns.
+// Names are parameters or JSON pointers into them, e.g. "/Ki_ap/4/1".  Each
+// of params["abc_generations"] generations accepts params["abc_particles"]
+// runs within its tolerance, params["abc_epsilon"] (none if null) for the
+// first and the params["abc_quantile"] quantile of the last one's
+// distances after that; runs are given up on as soon as they are out of
+// tolerance.  Proposals are tried in parallel batches on params["threads"]
+// threads and accepted in the order they were drawn, so the populations do
+// not depend on the number of threads.  Population g goes to
+// output_filename numbered g, as a binary table of weight, distance and
+// the parameters.
+int run_abc(const nlohmann::json& params, const std::map<double, int>& seeds, const string& out_fname) {
+    for (const char* key : {"serials", "branches", "batch", "restore_from", "save_to", "save_at", "checkpoint_store",
+                            "summary_file"}) {
+        if (params[key] != nullptr) {
+            std::cerr << "ABC-SMC does not support " << key << std::endl;
+            return -1;
+        }
+    }
+    string engine = params["engine"];
+    if (engine != "exact" and engine != "hybrid" and engine != "next_reaction") {
+        std::cerr << "Invalid engine for ABC-SMC: " << engine << " (exact, hybrid or next_reaction)" << std::endl;
+        return -1;
+    }
+    Event_Driven_NUCOVID check;
+    if (set_event_queue(check, params) != 0 or set_rng(check, params) != 0) return -1;
+    if (seeds.find(0) == seeds.end() or seeds.at(0) == -1) {
+        std::cerr << "ABC-SMC needs a time 0 random seed" << std::endl;
+        return -1;
+    }
+
+    const nlohmann::json& priors = params["abc_priors"];
+    if (not priors.is_object() or priors.empty()) {
+        std::cerr << "Invalid abc_priors: " << priors << " ({\"parameter\": [low, high], ...})" << std::endl;
+        return -1;
+    }
+    vector<string> names;
+    vector<nlohmann::json::json_pointer> pointers;
+    vector<double> low, high;
+    for (auto& el : priors.items()) {
+        const nlohmann::json& b = el.value();
+        nlohmann::json::json_pointer ptr;
+        try {
+            ptr = nlohmann::json::json_pointer(el.key()[0] == '/' ? el.key() : "/" + el.key());
+        } catch (const std::exception& e) {}
+        if (ptr.empty() or not params.contains(ptr) or not params[ptr].is_number() or not b.is_array() or b.size() != 2
+                or not b[0].is_number() or not b[1].is_number() or not (b[0] < b[1])) {
+            std::cerr << "Invalid abc_priors entry: " << el.key() << ": " << b
+                      << " (numeric parameter: [low, high])" << std::endl;
+            return -1;
+        }
+        names.push_back(el.key());
+        pointers.push_back(ptr);
+        low.push_back(b[0]);
+        high.push_back(b[1]);
+    }
+    const nlohmann::json& n_particles = params["abc_particles"];
+    const nlohmann::json& generations = params["abc_generations"];
+    const nlohmann::json& quantile = params["abc_quantile"];
+    const nlohmann::json& max_attempts = params["abc_max_attempts"];
+    if (not n_particles.is_number_integer() or n_particles < 1 or not generations.is_number_integer()
+            or generations < 1 or not quantile.is_number() or not (quantile > 0 and quantile <= 1)
+            or not max_attempts.is_number_integer() or max_attempts < n_particles
+            or not (params["abc_epsilon"] == nullptr or params["abc_epsilon"].is_number())) {
+        std::cerr << "Invalid abc_particles, abc_generations, abc_quantile, abc_max_attempts or abc_epsilon" << std::endl;
+        return -1;
+    }
+    if (params["abc_observed"] == nullptr) {
+        std::cerr << "ABC-SMC needs abc_observed" << std::endl;
+        return -1;
+    }
+    ObservedSeries observed;
+    if (observed.read(params["abc_observed"]) != 0) return -1;
+    if (observed.first_day() <= SEED_DAY or observed.last_day() > params["duration"].get<int>()) {
+        std::cerr << "Observed days must be after " << SEED_DAY << " and up to duration" << std::endl;
+        return -1;
+    }
+
+    const size_t N = n_particles;
+    const unsigned nthreads = params["threads"];
+    const uint32_t base_seed = seeds.at(0);
+    double epsilon = params["abc_epsilon"] == nullptr ? INFINITY : params["abc_epsilon"].get<double>();
+    AbcPopulation last(low, high, INFINITY);     // none yet: the first generation draws from the prior
+    for (uint64_t g = 0; g < generations; g++) {
+        auto wall_start = std::chrono::steady_clock::now();
+        mt19937 rng(replicate_seed(base_seed, (g << 32) | 0xFFFFFFFF));
+        AbcPopulation next(low, high, epsilon);
+        uint64_t attempts = 0;
+        uint64_t days = 0;
+        while (next.size() < N and attempts < max_attempts) {
+            // enough proposals for the particles still missing at the acceptance rate so far
+            const double rate = next.size() > 0 ? (double) next.size() / attempts : 1;
+            const uint64_t batch = min<uint64_t>(ceil((N - next.size()) / rate), max_attempts.get<uint64_t>() - attempts);
+            vector<vector<double>> proposals(batch);
+            for (auto& t : proposals) t = last.propose(rng);
+            vector<double> distances(batch);
+            vector<uint64_t> batch_days(batch, 0);
+            streambuf* progress = cout.rdbuf(NULL);     // the runs' own messages, one per proposal
+            parallel_for_stealing(batch, nthreads, [&](size_t k, unsigned) {
+                nlohmann::json p = params;
+                for (size_t j = 0; j < pointers.size(); j++) p[pointers[j]] = proposals[k][j];
+                std::map<double, int> run_seeds;
+                for (const auto& s : seeds) {
+                    run_seeds[s.first] = s.second == -1 ? -1 : replicate_seed(s.second, (g << 32) + attempts + k);
+                }
+                distances[k] = abc_distance(p, run_seeds, observed, epsilon, batch_days[k]);
+            });
+            cout.rdbuf(progress);
+            for (size_t k = 0; k < batch; k++) {
+                days += batch_days[k];
+                if (distances[k] <= epsilon and next.size() < N) {
+                    next.add(proposals[k], last.weight_of(proposals[k]), distances[k]);
+                }
+            }
+            attempts += batch;
+        }
+        if (next.size() == 0) {
+            std::cerr << "ABC-SMC generation " << g << " accepted no runs in " << attempts << " attempts" << std::endl;
+            return -1;
+        }
+        next.normalize();
+        nlohmann::json header = {{"generation", g}, {"epsilon", epsilon}, {"attempts", attempts}, {"params", params}};
+        if (not next.write(numbered_fname(out_fname, g), names, header.dump())) return -1;
+
+        const uint64_t full_days = attempts * (observed.last_day() - SEED_DAY + 1);
+        double wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+        std::cout << "generation, epsilon, accepted, attempts, days run of full runs', wall time: " << g << ", " << epsilon
+                  << ", " << next.size() << ", " << attempts << ", " << days << " of " << full_days << ", " << wall_time
+                  << std::endl;
+        if (next.size() < N) {
+            std::cerr << "ABC-SMC generation " << g << " accepted only " << next.size() << " of " << N
+                      << " runs in abc_max_attempts" << std::endl;
+            return -1;
+        }
+        epsilon = next.distance_quantile(quantile);
+        last = next;
+    }
+    return 0;
+}
+
+// Particle filter (see ParticleFilter) of params["filter_particles"] runs
+// of the exact engine from scratch through the series
+// params["filter_observed"], observed as in abc_observed, and on to
+// params["duration"].  The particles advance a day at a time on
+// params["threads"] threads and are resampled on each observed day; later
+// random_seeds are not used, since each particle is reseeded as it is
+// resampled instead.  Their daily output goes to the output file as a
+// summary_file table: on observed days of the particles as resampled, the
+// filtered distribution, and after the last of them the forecast.
+int run_filter(const nlohmann::json& params, const std::map<double, int>& seeds, const string& out_fname) {
+    for (const char* key : {"serials", "branches", "batch", "restore_from", "save_to", "save_at", "checkpoint_store",
+                            "summary_file", "abc_priors"}) {
+        if (params[key] != nullptr) {
+            std::cerr << "The particle filter does not support " << key << std::endl;
+            return -1;
+        }
+    }
+    if (params["engine"] != "exact") {
+        // stepping a day at a time, a hybrid run would set up its tau-leaping
+        // afresh and end it every day, and next_reaction runs cannot be continued
+        std::cerr << "The particle filter needs the exact engine" << std::endl;
+        return -1;
+    }
+    Event_Driven_NUCOVID check;
+    if (set_event_queue(check, params) != 0 or set_rng(check, params) != 0) return -1;
+    if (seeds.find(0) == seeds.end() or seeds.at(0) == -1) {
+        std::cerr << "The particle filter needs a time 0 random seed" << std::endl;
+        return -1;
+    }
+    const nlohmann::json& n_particles = params["filter_particles"];
+    const nlohmann::json& nb_size = params["filter_nb_size"];
+    if (not n_particles.is_number_integer() or n_particles < 1 or not nb_size.is_number() or not (nb_size > 0)) {
+        std::cerr << "Invalid filter_particles or filter_nb_size: " << n_particles << ", " << nb_size << std::endl;
+        return -1;
+    }
+    ObservedSeries observed;
+    if (observed.read(params["filter_observed"]) != 0) return -1;
+    const int duration = params["duration"];
+    if (observed.first_day() <= SEED_DAY or observed.last_day() > duration) {
+        std::cerr << "Observed days must be after " << SEED_DAY << " and up to duration" << std::endl;
+        return -1;
+    }
+
+    const size_t N = n_particles;
+    const unsigned nthreads = params["threads"];
+    const uint32_t base_seed = seeds.at(0);
+    vector<shared_ptr<Node>> base_nodes = initialize_1node(params);
+    vector<Event_Driven_NUCOVID> particles(N);
+    atomic<int> failed(0);      // particles, of the last step
+    streambuf* progress = cout.rdbuf(NULL);     // the runs' own messages, N a day
+    parallel_for_stealing(N, nthreads, [&](size_t i, unsigned) {
+        vector<shared_ptr<Node>> nodes;
+        for (const auto& n : base_nodes) nodes.push_back(make_shared<Node>(*n));
+        Event_Driven_NUCOVID sim(nodes, {{1}});
+        sim.format_text = false;
+        if (seed_from_scratch(sim, {{0, replicate_seed(base_seed, i)}}, params) != 0) failed++;
+        particles[i] = std::move(sim);
+    });
+    cout.rdbuf(progress);
+    if (failed > 0) {
+        std::cerr << "ERROR: " << failed << " particles could not be seeded" << std::endl;
+        return -1;
+    }
+    ParticleFilter filter(observed, nb_size, particles);
+    DailySummary summary(params["summary_sketch_k"].get<int>());
+    mt19937 rng(replicate_seed(base_seed, UINT64_MAX));
+
+    auto wall_start = std::chrono::steady_clock::now();
+    double step_time = 0;
+    double resample_time = 0;
+    const std::map<double, int> no_reseeds;
+    for (int day = SEED_DAY + 1; day <= duration; day++) {
+        auto step_start = std::chrono::steady_clock::now();
+        cout.rdbuf(NULL);
+        parallel_for_stealing(N, nthreads, [&](size_t i, unsigned) {
+            vector<string> out_buffer;
+            if (run_engine(filter.particles[i], 1, no_reseeds, params, out_buffer) != 0) failed++;
+        });
+        cout.rdbuf(progress);
+        if (failed > 0) {
+            std::cerr << "ERROR: " << failed << " particles failed on day " << day << std::endl;
+            return -1;
+        }
+        auto resample_start = std::chrono::steady_clock::now();
+        step_time += std::chrono::duration<double>(resample_start - step_start).count();
+        if (observed.observed(day)) {
+            const double ess = filter.assimilate(day, rng, nthreads, [&](size_t i) {
+                return replicate_seed(base_seed, ((uint64_t) day << 32) + i);
+            });
+            resample_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - resample_start).count();
+            std::cout << "day, effective sample size, log likelihood: " << day << ", " << ess << ", "
+                      << filter.log_likelihood << std::endl;
+        }
+        for (size_t i = 0; i < N; i++) summary.add(filter.rows(i, day));
+    }
+    if (not summary.write(out_fname, params["summary_quantiles"].get<vector<double>>())) return -1;
+    double wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    std::cout << "particles, clones, stepping time, resampling time, wall time: " << N << ", " << filter.clones << ", "
+              << step_time << ", " << resample_time << ", " << wall_time << std::endl;
+    return 0;
+}
+
+// Continues the checkpoint params["restore_from"] once per entry of
+// params["branches"], a list of parameter overrides (e.g. interventions),
+// on params["threads"] threads.  Each branch starts from a fork() of the
+// same restored state and writes its own numbered output file; branches
+// whose time 0 seed is -1 share the checkpoint's random state.  Every
+// branch is checked before any runs, and one that fails fails the run.
+int run_branches(const nlohmann::json& params, const UserProvided& upr, const string& out_fname) {
+    if (params["restore_from"] == nullptr or params["save_to"] != nullptr or params["save_at"] != nullptr
+            or params["checkpoint_store"] != nullptr) {
+        std::cerr << "Branches need restore_from and do not support save_to, save_at or checkpoint_store" << std::endl;
+        return -1;
+    }
+    const nlohmann::json& branches = params["branches"];
+    if (not branches.is_array()) {
+        std::cerr << "Invalid branches: " << branches << " (list of parameter overrides)" << std::endl;
+        return -1;
+    }
+    vector<nlohmann::json> branch_params(branches.size());
+    for (size_t b = 0; b < branches.size(); b++) {
+        if (apply_overrides(params, branches[b], "branches", branch_params[b]) != 0) return -1;
+        if (branches[b].contains("restore_from") or branches[b].contains("save_to") or branches[b].contains("save_at")
+                or branches[b].contains("serials")) {
+            std::cerr << "Branches cannot override restore_from, save_to, save_at or serials" << std::endl;
+            return -1;
+        }
+        string engine = branch_params[b]["engine"];
+        if (engine != "exact" and engine != "hybrid") {
+            std::cerr << "Invalid engine for branches: " << engine << " (exact or hybrid)" << std::endl;
+            return -1;
+        }
+    }
+
+    Event_Driven_NUCOVID base;
+    if (restore(params["restore_from"], base) != 0) return -1;
+    base.flush_events();
+    for (size_t b = 0; b < branches.size(); b++) {
+        Event_Driven_NUCOVID check;
+        if (set_event_queue(check, branch_params[b]) != 0 or set_rng(check, branch_params[b]) != 0) return -1;
+        UserProvided branch_upr = upr;
+        branch_upr.mark(branches[b]);
+        shared_ptr<Node> node = make_shared<Node>(*base.nodes[0]);
+        update_node(node, branch_params[b], branch_upr);
+    }
+
+    atomic<int> failed(0);      // branches
+    auto wall_start = std::chrono::steady_clock::now();
+    parallel_for_stealing(branches.size(), params["threads"], [&](size_t b, unsigned) {
+        const nlohmann::json& p = branch_params[b];
+        std::map<double, int> seeds;
+        for (auto d : p["random_seeds"]) seeds.emplace(d[0].get<double>(), d[1]);
+
+        Event_Driven_NUCOVID sim = base.fork();
+        UserProvided branch_upr = upr;
+        branch_upr.mark(branches[b]);
+        update_node(sim.nodes[0], p, branch_upr);
+        sim.lazy_contacts = p["lazy_contacts"];
+        vector<string> out_buffer;
+        if (set_event_queue(sim, p) != 0 or continue_rng(sim, p, branch_upr) != 0 or
+                run_engine(sim, p["duration"].get<double>(), seeds, p, out_buffer) != 0 or
+                not write_buffer(out_buffer, numbered_fname(out_fname, b), true)) {
+            std::cerr << "ERROR: branch " << b << " failed" << std::endl;
+            failed++;
+        }
+    });
+    double wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    std::cout << "branches, wall time: " << branches.size() << ", " << wall_time << std::endl;
+    if (failed > 0) {
+        std::cerr << "ERROR: " << failed << " of " << branches.size() << " branches failed" << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+// A run from scratch that reuses params["checkpoint_store"] (a directory):
+// it continues from the latest stored state that its own parameters and
+// seeds reproduce, if any, so only the days after it are simulated again,
+// and stores a checkpoint every params["checkpoint_store_every"] days for
+// later runs.  The output is the same as without the store; a checkpoint
+// that could not be stored fails the run.
+int run_with_store(const nlohmann::json& params, const std::map<double, int>& seeds, const string& out_fname) {
+    if (params["engine"] != "exact" or params["restore_from"] != nullptr or params["save_at"] != nullptr) {
+        std::cerr << "checkpoint_store needs the exact engine and does not support restore_from or save_at" << std::endl;
+        return -1;
+    }
+    const int every = params["checkpoint_store_every"];
+    if (every < 1) {
+        std::cerr << "Invalid checkpoint_store_every: " << every << std::endl;
+        return -1;
+    }
+    CheckpointStore store(params["checkpoint_store"].get<string>());
+    const double duration = params["duration"];
+
+    vector<vector<double>> infection_matrix = {{1}};
+    Event_Driven_NUCOVID sim(initialize_1node(params), infection_matrix);
+    sim.lazy_contacts = params["lazy_contacts"];
+    if (set_event_queue(sim, params) != 0 or set_rng(sim, params) != 0) return -1;
+
+    StoredCheckpoint from;
+    vector<string> prefix;      // output of the days before the stored state
+    bool resume = store.find(sim, seeds, ceil(duration) - 1, from);
+    if (resume) {
+        Event_Driven_NUCOVID stored;
+        resume = load_checkpoint(stored, from.path + ".ckpt") == 0 and store.load_output(from, prefix);
+        if (resume) {
+            // this run's parameters, which agree with the stored ones up to from.reach
+            for (size_t i = 0; i < stored.nodes.size(); i++) {
+                shared_ptr<Node> n = make_shared<Node>(*sim.nodes[i]);
+                n->state_counts = stored.nodes[i]->state_counts;
+                n->cumu_symptomatic = stored.nodes[i]->cumu_symptomatic;
+                n->cumu_admission = stored.nodes[i]->cumu_admission;
+                n->introduced = stored.nodes[i]->introduced;
+                n->last_day_read = from.reach;
+                stored.nodes[i] = n;
+            }
+            sim = stored;
+            std::cout << "Resuming from " << from.path << ".ckpt" << std::endl;
+        }
+    }
+
+    vector<string> failed;      // checkpoint files not written
+    CheckpointWriter writer([&failed](Event_Driven_NUCOVID& state, const string& fname) {
+        if (save_checkpoint(state, fname) != 0) failed.push_back(fname);
+    });
+    vector<StoredCheckpoint> taken;
+    vector<double> taken_at;
+    for (int day = every; day < duration; day += every) sim.snapshot_days.insert(day);
+    sim.snapshot = [&](int day, Event_Driven_NUCOVID& state) {
+        StoredCheckpoint c = store.entry(state, seeds, day);
+        if (store.contains(c)) return;
+        taken.push_back(c);
+        taken_at.push_back(state.Now);
+        writer.add(state, c.path + ".ckpt");
+    };
+
+    vector<string> out_buffer;
+    if (resume) {
+        if (run_engine(sim, duration - from.day, seeds, params, out_buffer) != 0) return -1;
+        prefix.insert(prefix.end(), out_buffer.begin() + 1, out_buffer.end());
+        out_buffer.swap(prefix);
+    } else {
+        if (run_from_scratch(sim, seeds, params, out_buffer) != 0) return -1;
+    }
+    if (not write_buffer(out_buffer, out_fname, true)) return -1;
+    if (params["save_to"] != nullptr and checkpoint(params["save_to"], sim, params) != 0) return -1;
+
+    // a run continued from a stored state starts printing on the day after
+    // its time; the stored output has the days before
+    writer.close();
+    bool stored = true;
+    for (size_t k = 0; k < taken.size(); k++) {
+        if (find(failed.begin(), failed.end(), taken[k].path + ".ckpt") != failed.end()) {
+            stored = false;
+            continue;
+        }
+        vector<string> lines(1, out_buffer[0]);
+        for (size_t l = 1; l < out_buffer.size(); l++) {
+            if (stoi(out_buffer[l].substr(out_buffer[l].find('\t') + 1)) < ceil(taken_at[k])) lines.push_back(out_buffer[l]);
         }
+        stored = store.save_output(taken[k], lines) and stored;
+    }
+    if (not stored) {
+        std::cerr << "ERROR: Could not add checkpoints to the checkpoint store " << params["checkpoint_store"] << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+// One run, continuing restore_from or from scratch, and the checkpoints
+// asked for with save_at and save_to.  The daily output goes to out_buffer
+// as text, or as it is produced to stream, or as numbers to daily.
+int single_run(const nlohmann::json& params, UserProvided& upr, const std::map<double, int>& seeds,
+               vector<string>& out_buffer, vector<DailyState>* daily = NULL, StreamWriter* stream = NULL,
+               RunReport* report = NULL) {
+    if (params["save_at"] != nullptr and params["engine"] != "exact") {
+        std::cerr << "save_at needs the exact engine" << std::endl;
+        return -1;
+    }
+    vector<string> failed;      // save_at files not written
+    CheckpointWriter writer([&params, &failed](Event_Driven_NUCOVID& state, const string& fname) {
+        if (checkpoint(fname, state, params) != 0) failed.push_back(fname);
+    });
+    auto route_output = [&](Event_Driven_NUCOVID& s) {
+        s.record_daily = daily;
+        s.format_text = daily == NULL;
+        s.stream_to = stream;
+    };
+
+    Event_Driven_NUCOVID sim;
+    auto restore_f = params["restore_from"];
+    if (restore_f != nullptr) {
+        if (restore(restore_f, sim) != 0) return -1;
+        if (schedule_checkpoints(sim, params, writer) != 0) return -1;
+        route_output(sim);
+
+        update_node(sim.nodes[0], params, upr);
+        sim.lazy_contacts = params["lazy_contacts"];
+        if (set_event_queue(sim, params) != 0) return -1;
+        if (continue_rng(sim, params, upr) != 0) return -1;
+        if (run_engine(sim, params["duration"].get<double>(), seeds, params, out_buffer) != 0) return -1;
+    } else {
+        // Start from scratch
+        vector<vector<double>> infection_matrix = {{1}};
+        sim = Event_Driven_NUCOVID(initialize_1node(params), infection_matrix);
+        if (schedule_checkpoints(sim, params, writer) != 0) return -1;
+        route_output(sim);
+        RunReport own;
+        if (run_stopping(sim, seeds, params, out_buffer, report ? *report : own) != 0) return -1;
+    }
+
+    writer.close();
+    if (not failed.empty()) return -1;
+    auto save_f = params["save_to"];
+    if (save_f != nullptr and checkpoint(save_f, sim, params) != 0) return -1;
+    return 0;
+}
+
+int simulate (const nlohmann::json& params, UserProvided& upr) {
+    const string format = params["output_format"];
+    if (format != "text" and format != "binary") {
+        std::cerr << "Invalid output_format: " << format << " (text or binary)" << std::endl;
+        return -1;
+    }
+    if (format == "binary" and (params["engine"] == "ode" or params["branches"] != nullptr
+                                or params["checkpoint_store"] != nullptr)) {
+        std::cerr << "Binary output does not support the ode engine, branches or checkpoint_store" << std::endl;
+        return -1;
+    }
+    if ((params["summary_file"] != nullptr or params["precision_targets"] != nullptr) and params["serials"] == nullptr) {
+        std::cerr << "summary_file and precision_targets need serials" << std::endl;
+        return -1;
+    }
+    if (check_stop_rules(params) != 0) return -1;
+    if ((params["abc_priors"] != nullptr or params["filter_observed"] != nullptr) and params["engine"] == "ode") {
+        std::cerr << "ABC-SMC and the particle filter do not support the ode engine" << std::endl;
+        return -1;
+    }
+    if (params["engine"] == "ode") return run_ode(params);
+    if (params["engine"] == "next_reaction" and (params["restore_from"] != nullptr or params["save_to"] != nullptr)) {
+        std::cerr << "The next_reaction engine does not support restore_from or save_to" << std::endl;
+        return -1;
     }
 
     std::map<double, int> seeds;
@@ -206,63 +1277,174 @@ void runsim (const nlohmann::json& params, UserProvided& upr) {
         // std::cout << d[0] << ", " << d[1] << std::endl;
     }
 
-    double duration = params["duration"].get<double>();
     string out_fname = params["output_directory"].get<string>()+ "/" +
             params["output_filename"].get<string>();
     vector<string> out_buffer;
 
-    auto restore_f = params["restore_from"];
-    if (restore_f != nullptr) {
-        cout << "Deserializing " << static_cast<string>(restore_f) << endl;
-        ifstream file(restore_f, ios::binary);
-        cereal::BinaryInputArchive iarchive(file);
-        Event_Driven_NUCOVID sim;
-        iarchive(sim);
+    if (params["abc_priors"] != nullptr) return run_abc(params, seeds, out_fname);
+    if (params["filter_observed"] != nullptr) return run_filter(params, seeds, out_fname);
+    if (params["serials"] != nullptr) return run_ensemble(params, seeds, out_fname);
+    if (params["branches"] != nullptr) return run_branches(params, upr, out_fname);
+    if (params["checkpoint_store"] != nullptr) return run_with_store(params, seeds, out_fname);
 
-        update_node(sim.nodes[0], params, upr);
-        auto seed = seeds[0.0];
-        if (seed != -1) {
-            sim.rng.seed(seed);
+    // stop rules mark the output with how the run ended, and restarts
+    // replace it, so it is only written at the end
+    const bool marked = stop_rules(params);
+    RunReport report;
+    auto print_report = [&report]() {
+        std::cout << "stopped, stop day, restarts, days not run, days run by restarted attempts: " << report.stopped
+                  << ", " << report.stop_day << ", " << report.restarts << ", " << report.days_not_run << ", "
+                  << report.days_restarted << std::endl;
+    };
+    if (format == "binary") {
+        vector<DailyState> daily;
+        if (single_run(params, upr, seeds, out_buffer, &daily, NULL, &report) != 0) return -1;
+        vector<int> stopped(daily.size(), report.stopped);
+        if (not write_daily_binary(daily, out_fname, params.dump(), NULL, marked ? &stopped : NULL)) return -1;
+        if (marked) print_report();
+        return 0;
+    }
+    if (marked) {
+        if (single_run(params, upr, seeds, out_buffer, NULL, NULL, &report) != 0) return -1;
+        mark_stopped(out_buffer, report.stopped);
+        if (not write_buffer(out_buffer, out_fname, true)) return -1;
+        print_report();
+        return 0;
+    }
+    StreamWriter out(out_fname, true, params["output_buffer_bytes"], params["output_flush_thread"]);
+    out.write(daily_header());
+    if (single_run(params, upr, seeds, out_buffer, NULL, &out) != 0) {
+        out.discard();
+        return -1;
+    }
+    return out.close() ? 0 : -1;
+}
+
+// Key of the output of params in a ResultCache: everything that can change
+// it, with defaults filled in, and the model binary itself.
+string result_key(const nlohmann::json& params) {
+    nlohmann::json p = params;
+    for (const char* key : {"output_directory", "output_filename", "output_buffer_bytes", "output_flush_thread",
+                            "print_params", "result_cache", "result_cache_bytes", "threads", "checkpoint_store",
+                            "checkpoint_store_every"}) p.erase(key);
+    ContentHash h;
+    h.add(p.dump());        // objects are dumped with sorted keys
+    h.add(ResultCache::build_id());
+    return h.hex();
+}
+
+// Reply frame of the server to one request, a JSON object of parameters
+// over the server's own: a line
+//
+//     result <id> ok <n>
+//
+// and the n lines of daily output, header first, or
+//
+//     result <id> error 1
+//
+// and a line saying what went wrong, the fields separated by tabs.  id is
+// the request's "id", if it has one, or its line number from 0.
+string serve_request(const nlohmann::json& base, const UserProvided& base_upr, const string& line, size_t index) {
+    string id = to_string(index);
+    string error;
+    vector<string> out_buffer;
+    try {
+        nlohmann::json request = nlohmann::json::parse(line);
+        if (not request.is_object()) throw std::runtime_error("request is not a JSON object");
+        if (request.contains("id")) {
+            id = request["id"].is_string() ? request["id"].get<string>() : request["id"].dump();
+            replace(id.begin(), id.end(), '\t', ' ');
+            replace(id.begin(), id.end(), '\n', ' ');
+            request.erase("id");
         }
-        out_buffer = sim.run_simulation(duration, seeds, false);
-        write_buffer(out_buffer, out_fname, true);
+        for (const char* key : {"serials", "branches", "batch", "save_to", "save_at", "checkpoint_store", "result_cache",
+                                "summary_file", "abc_priors", "filter_observed"}) {
+            if (request.contains(key)) throw std::runtime_error(string("the server does not support ") + key);
+        }
+        for (auto& el : request.items()) {
+            if (not base.contains(el.key()) or el.key() == "serve") throw std::runtime_error("invalid parameter: " + el.key());
+        }
+        nlohmann::json params;
+        apply_overrides(base, request, "serve", params);
+        UserProvided upr = base_upr;
+        upr.mark(request);
+        std::map<double, int> seeds;
+        for (auto d : params["random_seeds"]) seeds.emplace(d[0].get<double>(), d[1]);
 
-        auto save_f = params["save_to"];
-        if (save_f != nullptr) {
-            checkpoint(save_f, sim);
+        if (params["engine"] == "ode" or params["engine"] == "next_reaction") {
+            if (params["restore_from"] != nullptr) throw std::runtime_error("restore_from needs the exact or hybrid engine");
         }
-    } else {
-        // Start from scratch
-        vector<string> out_buffer;
-        vector<shared_ptr<Node>> nodes = initialize_1node(params);
-        vector<vector<double>> infection_matrix;
-        for(int i = 0; i < 1; i++) {
-            vector<double> inf_prob;
-            inf_prob.push_back(1);
-            infection_matrix.push_back(inf_prob);
+        if (check_stop_rules(params) != 0) throw std::runtime_error("invalid stop rules, see the model's standard error");
+        RunReport report;
+        if (params["engine"] == "ode") {
+            out_buffer = ode_outputs({initialize_1node(params)}, params)[0];
+        } else if (single_run(params, upr, seeds, out_buffer, NULL, NULL, &report) != 0) {
+            throw std::runtime_error("the run failed, see the model's standard error");
         }
+        if (stop_rules(params)) mark_stopped(out_buffer, report.stopped);
+    } catch (const std::exception& e) {
+        error = e.what();
+        replace(error.begin(), error.end(), '\n', ' ');
+    }
 
-        Event_Driven_NUCOVID sim(nodes, infection_matrix);
+    if (not error.empty()) return "result\t" + id + "\terror\t1\n" + error + "\n";
+    string frame = "result\t" + id + "\tok\t" + to_string(out_buffer.size()) + "\n";
+    for (const auto& l : out_buffer) frame += l + "\n";
+    return frame;
+}
 
-        auto iter = seeds.find(0);
-        if (iter == seeds.end()) {
-            std::cout << "Aborting. Please provide an initial time 0 random seed" << std::endl;
-            return;
+// Runs the requests read from stdin, or from connections to the Unix socket
+// params["serve"], on params["threads"] threads; see serve_request().  The
+// parameters given on the command line are the defaults of each request.
+int serve(const nlohmann::json& params, const UserProvided& upr) {
+    for (const char* key : {"serials", "branches", "batch", "save_to", "save_at", "checkpoint_store", "result_cache",
+                            "summary_file", "abc_priors", "filter_observed"}) {
+        if (params[key] != nullptr) {
+            std::cerr << "The server does not support " << key << std::endl;
+            return -1;
         }
-        sim.rng.seed(iter->second);
-        sim.Now = 9;
-        duration -= sim.Now;
-        sim.rand_infect(10, nodes[0]);//*2
-        out_buffer = sim.run_simulation(duration, seeds, false);
-        write_buffer(out_buffer, out_fname, true);
+    }
+    auto handle = [&](const string& line, size_t index) { return serve_request(params, upr, line, index); };
+    const unsigned nthreads = params["threads"];
+    if (params["serve"] == "stdin") {
+        // replies go to stdout, so progress messages go to stderr
+        cout.rdbuf(cerr.rdbuf());
+        serve_stream(0, 1, nthreads, handle);
+        return 0;
+    }
+    return serve_unix_socket(params["serve"], nthreads, handle);
+}
 
-        auto save_f = params["save_to"];
-        if (save_f != nullptr) {
-            checkpoint(save_f, sim);
+// with params["result_cache"], a run whose output is already in the cache
+// only copies it to output_directory; only runs that succeed are cached
+int runsim (const nlohmann::json& params, UserProvided& upr) {
+    if (params["serve"] != nullptr) return serve(params, upr);
+    cout << "Running Sim" << endl;
+    if (params["print_params"]) {
+        for (auto& el : params.items()) {
+            std::cout << el.key() << " : " << el.value() << std::endl;
         }
     }
+    if (params["result_cache"] == nullptr) return simulate(params, upr);
+    // one output file that depends only on the parameters and has no other effect
+    if (params["restore_from"] != nullptr or params["save_to"] != nullptr or params["save_at"] != nullptr
+            or params["branches"] != nullptr or params["batch"] != nullptr or params["summary_file"] != nullptr
+            or params["abc_priors"] != nullptr or params["filter_observed"] != nullptr) {
+        std::cout << "Not caching runs with restore_from, save_to, save_at, branches, batch, summary_file, abc_priors"
+                  << " or filter_observed" << std::endl;
+        return simulate(params, upr);
+    }
 
-    return;
+    string out_fname = params["output_directory"].get<string>()+ "/" + params["output_filename"].get<string>();
+    ResultCache cache(params["result_cache"], params["result_cache_bytes"]);
+    const string key = result_key(params);
+    if (cache.fetch(key, out_fname)) {
+        std::cout << "Cached result " << key << std::endl;
+        return 0;
+    }
+    if (simulate(params, upr) != 0) return -1;
+    cache.add(key, out_fname);
+    return 0;
 }
 
 void usage() {
@@ -271,12 +1453,7 @@ void usage() {
 
 int parse_params(nlohmann::json& params, const std::string& cl_params, UserProvided& upr) {
     nlohmann::json j2 = nlohmann::json::parse(cl_params);
-    upr.kaysmp = j2.contains("nmrtr_Kasymp");
-    upr.kmild = j2.contains("nmrtr_Kmild");
-    upr.frac_as = j2.contains("frac_infectiousness_As");
-    upr.frac_det = j2.contains("frac_infectiousness_det");
-    upr.ini_ki = j2.contains("ini_Ki");
-    upr.ki_ap = j2.contains("Ki_ap");
+    upr.mark(j2);
 
     for (auto& el : j2.items()) {
         string key = el.key();
@@ -294,6 +1471,9 @@ void load_default_params(nlohmann::json& params) {
     // DEFAULT PARAMETERS
     params["output_directory"] = "./";
     params["output_filename"] = "daily_output.txt";
+    params["output_format"] = "text";   // text or binary (columnar, see Daily_Output.h)
+    params["output_buffer_bytes"] = 1 << 20;    // text output is written out whenever this much is buffered
+    params["output_flush_thread"] = false;      // write text output from a thread of its own
     params["nmrtr_Kasymp"] = 0.4066;
     params["nmrtr_Kmild"] = 0.921;
     params["ini_Ki"] = 1.0522;
@@ -301,6 +1481,46 @@ void load_default_params(nlohmann::json& params) {
     params["frac_infectiousness_det"] =  0.00733;
     params["duration"] = 371; 
     params["print_params"] = false;
+    params["lazy_contacts"] = false;
+    params["event_queue"] = nullptr;    // binary, dary, calendar or radix
+    params["rng"] = nullptr;            // mt19937 (null: a restored run's own, else mt19937) or philox
+    params["engine"] = "exact";         // exact, hybrid, next_reaction or ode
+    // hybrid only: leaps per day.  Rates are held for a whole leap, which biases
+    // the counts upward: against exact over 32 replicates of the defaults,
+    // 16 leaps gave about +3.5% DEA and +3.9% cumu_adm, 64 about +1.3%, and
+    // 128 was within one standard error (~1%) at a seventh of exact's time.
+    params["tau_steps_per_day"] = 128;
+    params["tau_leap_above"] = 2000;    // hybrid only: active infections at which leaping starts
+    params["tau_exact_below"] = 500;    // hybrid only: active infections at which exact simulation resumes
+    params["ode_steps_per_day"] = 2;    // ode only: RK4 steps per day
+    params["batch"] = nullptr;          // ode (or model_mpi) only: list of parameter overrides, one output file each
+    params["serials"] = nullptr;        // [first, last]: run that ensemble of replicates in one process
+    params["threads"] = 0;              // ensemble or branch threads, 0 for one per core
+    params["summary_file"] = nullptr;   // serials only: quantiles across the replicates per node, day and column
+    params["summary_quantiles"] = {0.025, 0.25, 0.5, 0.75, 0.975};
+    params["summary_sketch_k"] = 200;   // values kept per quantile sketch; quantiles are exact up to this many replicates
+    params["summary_only"] = false;     // with summary_file: no per-replicate daily output
+    params["precision_targets"] = nullptr;  // serials only: [[column, day, quantile, width], ...], run until met
+    params["precision_relative"] = false;   // precision_targets: widths as fractions of the estimates
+    params["precision_batch"] = 50;     // precision_targets: replicates between checks of the targets
+    params["precision_min_replicates"] = 30;    // precision_targets: replicates before any target can be met
+    params["abc_priors"] = nullptr;     // {"parameter": [low, high], ...}: calibrate those by ABC-SMC, uniform priors
+    params["abc_observed"] = nullptr;   // abc_priors: tab-separated daily series to fit, time and daily output columns
+    params["abc_particles"] = 100;      // abc_priors: particles per generation
+    params["abc_generations"] = 5;
+    params["abc_quantile"] = 0.5;       // abc_priors: quantile of a generation's distances that is the next tolerance
+    params["abc_epsilon"] = nullptr;    // abc_priors: tolerance of the first generation, none if null
+    params["abc_max_attempts"] = 100000;        // abc_priors: runs tried per generation at most
+    params["filter_observed"] = nullptr;        // daily series as abc_observed: particle filter through it, output a summary
+    params["filter_particles"] = 100;
+    params["filter_nb_size"] = 10;      // filter_observed: negative binomial size of the observation noise
+    params["stop_extinct"] = false;     // end runs once nobody is exposed or infectious (E, AP, SYM, HOS and CRIT all 0)
+    params["stop_cumu_adm"] = nullptr;  // [[day, low, high], ...]: end runs whose cumu_adm on day is outside [low, high]
+    params["condition_on_takeoff"] = false;     // start runs that die out before taking off over with new seeds
+    params["takeoff_cumu_sym"] = 100;   // condition_on_takeoff: cumu_sym at which a run has taken off
+    params["takeoff_max_restarts"] = 1000;
+    params["branches"] = nullptr;       // list of parameter overrides, each continuing restore_from in its own output file
+    params["checkpoint_format"] = "flat";   // save_to format, flat or cereal (restore_from reads both)
     params["Ki_ap"] =  {
         {0, 1.0     },
         {28, 0.6263 },
@@ -322,9 +1542,16 @@ void load_default_params(nlohmann::json& params) {
     random_device rd;
     params["random_seeds"] = {{0, rd()}};
     params["save_to"] = nullptr;
+    params["save_at"] = nullptr;        // [[day, file], ...]: also checkpoint at those days (exact engine)
+    params["checkpoint_store"] = nullptr;       // directory of checkpoints to continue from and add to (exact engine)
+    params["checkpoint_store_every"] = 14;      // days between checkpoints added to checkpoint_store
+    params["result_cache"] = nullptr;           // directory of earlier outputs, reused for the same parameters
+    params["result_cache_bytes"] = 1 << 30;     // result_cache size limit; least recently used outputs go first
+    params["serve"] = nullptr;          // "stdin" or a Unix socket path: run the parameter sets sent there, one JSON object per line
     params["restore_from"] = nullptr;
 } 
 
+#ifndef NUCOVID_NO_MAIN
 int main(int argc, char* argv[]) { 
     if (argc > 2) {
         usage();
@@ -337,7 +1564,8 @@ int main(int argc, char* argv[]) {
             int ret_val = parse_params(params, argv[1], upr);
             if (ret_val != 0) return -1;
         }
-        runsim(params, upr);
+        if (runsim(params, upr) != 0) return -1;
     }
     return 0;
 }
+#endif
@@ -0,0 +1,77 @@
+#ifndef CHICAGO_YR1_H
+#define CHICAGO_YR1_H
+
+// The parts of the chicago_yr1 driver that other front ends (the C API in
+// nucovid_api.cpp, the MPI driver in chicago_mpi.cpp) build on: default parameters, parsing them, building the
+// node from them and running or checkpointing a simulation.
+
+#include <map>
+#include "NUCOVID_cereal.h"
+#include "NUCOVID_checkpoint.h"
+#include "json.hpp"
+
+struct UserProvided {
+    bool kaysmp, kmild, frac_as, frac_det, ini_ki, ki_ap, random_seeds;
+
+    UserProvided() : kaysmp(false), kmild(false), frac_as(false), frac_det(false),
+                     ini_ki(false), ki_ap(false), random_seeds(false) {}
+
+    // flag the parameters given in j, keeping those already flagged
+    void mark(const nlohmann::json& j) {
+        kaysmp = kaysmp or j.contains("nmrtr_Kasymp");
+        kmild = kmild or j.contains("nmrtr_Kmild");
+        frac_as = frac_as or j.contains("frac_infectiousness_As");
+        frac_det = frac_det or j.contains("frac_infectiousness_det");
+        ini_ki = ini_ki or j.contains("ini_Ki");
+        ki_ap = ki_ap or j.contains("Ki_ap");
+        random_seeds = random_seeds or j.contains("random_seeds");
+    }
+};
+
+// Runs from scratch are seeded on this day, the first of their output
+const int SEED_DAY = 9;
+
+// How a run under the stop rules ended (see run_stopping())
+enum { RAN_TO_END = 0, STOP_EXTINCT = 1, STOP_CUMU_ADM = 2 };
+struct RunReport {
+    int stopped;                // RAN_TO_END or the STOP_ rule that ended it
+    int stop_day;               // the last day the run got to
+    int restarts;               // of condition_on_takeoff
+    double days_not_run;        // from stop_day to duration
+    double days_restarted;      // run by attempts that did not take off
+
+    RunReport() : stopped(RAN_TO_END), stop_day(0), restarts(0), days_not_run(0), days_restarted(0) {}
+};
+
+void load_default_params(nlohmann::json& params);
+int parse_params(nlohmann::json& params, const std::string& cl_params, UserProvided& upr);
+
+vector<shared_ptr<Node>> initialize_1node(const nlohmann::json& params);
+void update_node(shared_ptr<Node>& node, const nlohmann::json& params, UserProvided& upr);
+int set_event_queue(Event_Driven_NUCOVID& sim, const nlohmann::json& params);
+int set_rng(Event_Driven_NUCOVID& sim, const nlohmann::json& params);
+int continue_rng(Event_Driven_NUCOVID& sim, const nlohmann::json& params, const UserProvided& upr);
+
+int run_engine(Event_Driven_NUCOVID& sim, double duration, const std::map<double, int>& seeds,
+               const nlohmann::json& params, vector<string>& out_buffer);
+int seed_from_scratch(Event_Driven_NUCOVID& sim, const std::map<double, int>& seeds, const nlohmann::json& params);
+int run_from_scratch(Event_Driven_NUCOVID& sim, const std::map<double, int>& seeds,
+                     const nlohmann::json& params, vector<string>& out_buffer);
+bool stop_rules(const nlohmann::json& params);
+int check_stop_rules(const nlohmann::json& params);
+int run_stopping(Event_Driven_NUCOVID& sim, const std::map<double, int>& seeds, const nlohmann::json& params,
+                 vector<string>& out_buffer, RunReport& report);
+void mark_stopped(vector<string>& out_buffer, int stopped);
+
+int apply_overrides(const nlohmann::json& params, const nlohmann::json& overrides, const string& reserved,
+                    nlohmann::json& p);
+string numbered_fname(const string& fname, size_t i);
+int check_ensemble(const nlohmann::json& params);
+int run_replicate(const nlohmann::json& params, const vector<shared_ptr<Node>>& base_nodes,
+                  const std::map<double, int>& seeds, int serial, vector<string>* out_buffer, vector<DailyState>* daily,
+                  RunReport* report = NULL);
+
+int checkpoint(const string& fname, Event_Driven_NUCOVID& sim, const nlohmann::json& params);
+int restore(const string& fname, Event_Driven_NUCOVID& sim);
+
+#endif
@@ -0,0 +1,169 @@
+#include <climits>
+#include <memory>
+#include "NUCOVID_api.h"
+#include "NUCOVID_next_reaction.h"
+#include "chicago_yr1.h"
+
+// The C API of NUCOVID_api.h over the chicago_yr1 driver.
+
+struct nucovid_sim {
+    nlohmann::json params;
+    UserProvided upr;
+    std::map<double, int> seeds;
+    Event_Driven_NUCOVID sim;
+    bool restored;
+    vector<DailyState> daily;
+    // the next_reaction engine keeps state between runs of sim
+    std::unique_ptr<NextReaction_NUCOVID> nr;
+};
+
+static thread_local string last_error;
+
+static_assert(NUCOVID_COLUMNS == DAILY_COLUMNS, "the API's columns are the daily output's");
+
+static int fail(const string& what) {
+    last_error = what;
+    return -1;
+}
+
+// parameters over the defaults, as the model binary takes them
+static std::unique_ptr<nucovid_sim> new_sim(const char* params_json) {
+    std::unique_ptr<nucovid_sim> s(new nucovid_sim);
+    s->restored = false;
+    load_default_params(s->params);
+    if (parse_params(s->params, params_json ? params_json : "{}", s->upr) != 0) {
+        fail("invalid parameter, see standard error");
+        return NULL;
+    }
+    for (auto d : s->params["random_seeds"]) s->seeds.emplace(d[0].get<double>(), d[1]);
+    return s;
+}
+
+// Every exported function that can throw catches it, since exceptions must
+// not cross the C interface.
+
+extern "C" {
+
+const char* nucovid_column_name(int column) {
+    return column >= 0 and column < NUCOVID_COLUMNS ? DAILY_COLUMN_NAMES[column] : NULL;
+}
+
+nucovid_sim* nucovid_create(const char* params_json) {
+    try {
+        std::unique_ptr<nucovid_sim> s = new_sim(params_json);
+        if (not s) return NULL;
+        if (s->params["restore_from"] != nullptr) {
+            const string fname = s->params["restore_from"];
+            return nucovid_restore(fname.c_str(), params_json);
+        }
+        vector<vector<double>> infection_matrix = {{1}};
+        s->sim = Event_Driven_NUCOVID(initialize_1node(s->params), infection_matrix);
+        if (seed_from_scratch(s->sim, s->seeds, s->params) != 0) {
+            fail("could not seed the simulation, see standard error");
+            return NULL;
+        }
+        s->sim.record_daily = &s->daily;
+        s->sim.format_text = false;
+        return s.release();
+    } catch (const std::exception& e) {
+        fail(e.what());
+        return NULL;
+    }
+}
+
+nucovid_sim* nucovid_restore(const char* fname, const char* params_json) {
+    try {
+        std::unique_ptr<nucovid_sim> s = new_sim(params_json);
+        if (not s) return NULL;
+        if (s->params["engine"] != "exact" and s->params["engine"] != "hybrid") {
+            fail("restoring needs the exact or hybrid engine");
+            return NULL;
+        }
+        if (restore(fname, s->sim) != 0) {
+            fail(string("could not restore ") + fname);
+            return NULL;
+        }
+        update_node(s->sim.nodes[0], s->params, s->upr);
+        s->sim.lazy_contacts = s->params["lazy_contacts"];
+        if (set_event_queue(s->sim, s->params) != 0 or continue_rng(s->sim, s->params, s->upr) != 0) {
+            fail("invalid event_queue or rng");
+            return NULL;
+        }
+        s->restored = true;
+        s->sim.record_daily = &s->daily;
+        s->sim.format_text = false;
+        return s.release();
+    } catch (const std::exception& e) {
+        fail(e.what());
+        return NULL;
+    }
+}
+
+double nucovid_duration(const nucovid_sim* s) {
+    try {
+        const double duration = s->params["duration"].get<double>();
+        return s->restored ? duration : duration - SEED_DAY;
+    } catch (const std::exception& e) {
+        fail(e.what());
+        return NAN;
+    }
+}
+
+int nucovid_run(nucovid_sim* s, double duration) {
+    try {
+        const size_t before = s->daily.size();
+        const int last_day = before ? s->daily.back().day : INT_MIN;
+        vector<string> out_buffer;
+        if (s->params["engine"] == "next_reaction") {
+            if (not s->nr) s->nr.reset(new NextReaction_NUCOVID(s->sim));
+            out_buffer = s->nr->run_simulation(duration, s->seeds, false);
+        } else if (run_engine(s->sim, duration, s->seeds, s->params, out_buffer) != 0) {
+            return fail("invalid engine");
+        }
+        // a continued run starts by printing the day the last one ended on
+        size_t keep = before;
+        while (keep < s->daily.size() and s->daily[keep].day <= last_day) keep++;
+        s->daily.erase(s->daily.begin() + before, s->daily.begin() + keep);
+        return 0;
+    } catch (const std::exception& e) {
+        return fail(e.what());
+    }
+}
+
+size_t nucovid_rows(const nucovid_sim* s) {
+    return s->daily.size();
+}
+
+int nucovid_column(const nucovid_sim* s, int column, double* out) {
+    if (column < 0 or column >= NUCOVID_COLUMNS) return fail("no such column");
+    for (size_t r = 0; r < s->daily.size(); r++) {
+        const DailyState& ds = s->daily[r];
+        switch (column) {
+            case 0:  out[r] = ds.node; break;
+            case 1:  out[r] = ds.day; break;
+            case 2:  out[r] = ds.Ki; break;
+            default: out[r] = ds.counts[column - 3];
+        }
+    }
+    return 0;
+}
+
+int nucovid_checkpoint(nucovid_sim* s, const char* fname) {
+    try {
+        if (s->params["engine"] == "next_reaction") return fail("the next_reaction engine cannot be checkpointed");
+        if (checkpoint(fname, s->sim, s->params) != 0) return fail("could not write the checkpoint, see standard error");
+        return 0;
+    } catch (const std::exception& e) {
+        return fail(e.what());
+    }
+}
+
+void nucovid_destroy(nucovid_sim* s) {
+    delete s;
+}
+
+const char* nucovid_last_error(void) {
+    return last_error.c_str();
+}
+
+}
@@ -0,0 +1,123 @@
+#ifndef ABC_SMC_H
+#define ABC_SMC_H
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+#include <algorithm>
+#include "Daily_Output.h"
+#include "Observed_Series.h"
+
+using namespace std;
+
+// One generation of ABC-SMC, as the population Monte Carlo of Beaumont et
+// al. (2009): particles over parameters with uniform priors on [low, high],
+// each with its weight and its run's distance to the data.  The next
+// generation draws particles of this one by weight and moves them with a
+// Gaussian kernel of twice the weighted variance of each parameter.
+class AbcPopulation {
+        vector<double> sd;      // of the kernel, per parameter
+
+    public:
+        vector<double> low;
+        vector<double> high;
+        double epsilon;         // tolerance the particles were accepted at
+        vector<vector<double>> theta;   // [particle][parameter]
+        vector<double> weights;
+        vector<double> distances;
+
+        AbcPopulation(const vector<double>& low_, const vector<double>& high_, double eps) :
+            low(low_), high(high_), epsilon(eps) {}
+
+        size_t size() const { return theta.size(); }
+
+        void add(const vector<double>& t, double weight, double distance) {
+            theta.push_back(t);
+            weights.push_back(weight);
+            distances.push_back(distance);
+        }
+
+        // weights summing to 1, and the kernel for proposals from them
+        void normalize() {
+            double total = 0;
+            for (double w : weights) total += w;
+            for (double& w : weights) w /= total;
+            sd.assign(low.size(), 0);
+            for (size_t k = 0; k < low.size(); k++) {
+                double mean = 0;
+                for (size_t i = 0; i < size(); i++) mean += weights[i] * theta[i][k];
+                double var = 0;
+                for (size_t i = 0; i < size(); i++) var += weights[i] * (theta[i][k] - mean) * (theta[i][k] - mean);
+                sd[k] = sqrt(2 * var);
+            }
+        }
+
+        // Parameters to try next: from the prior if this population is
+        // empty (the first generation), else a moved particle, drawn again
+        // until it is inside the prior.
+        vector<double> propose(mt19937& rng) const {
+            vector<double> t(low.size());
+            if (theta.empty()) {
+                for (size_t k = 0; k < t.size(); k++) t[k] = uniform_real_distribution<double>(low[k], high[k])(rng);
+                return t;
+            }
+            discrete_distribution<size_t> pick(weights.begin(), weights.end());
+            normal_distribution<double> step(0, 1);
+            while (true) {
+                const vector<double>& from = theta[pick(rng)];
+                bool inside = true;
+                for (size_t k = 0; k < t.size(); k++) {
+                    t[k] = from[k] + sd[k] * step(rng);
+                    inside = inside and t[k] >= low[k] and t[k] <= high[k];
+                }
+                if (inside) return t;
+            }
+        }
+
+        // unnormalized weight in the next generation of a particle proposed
+        // from this one: prior over the kernel's mixture density
+        double weight_of(const vector<double>& t) const {
+            if (theta.empty()) return 1;
+            vector<double> log_terms(size());
+            for (size_t i = 0; i < size(); i++) {
+                double z2 = 0;
+                for (size_t k = 0; k < t.size(); k++) {
+                    if (sd[k] > 0) z2 += (t[k] - theta[i][k]) * (t[k] - theta[i][k]) / (sd[k] * sd[k]);
+                }
+                log_terms[i] = log(weights[i]) - z2 / 2;
+            }
+            const double top = *max_element(log_terms.begin(), log_terms.end());
+            double mixture = 0;
+            for (double l : log_terms) mixture += exp(l - top);
+            return exp(-top) / mixture;
+        }
+
+        // the q quantile of the distances, the next generation's tolerance
+        double distance_quantile(double q) const {
+            vector<double> d = distances;
+            sort(d.begin(), d.end());
+            const double h = (d.size() - 1) * q;
+            const size_t lo = floor(h);
+            const size_t hi = ceil(h);
+            return d[lo] + (h - lo) * (d[hi] - d[lo]);
+        }
+
+        // Write the particles to filename as a binary table (Daily_Output.h)
+        // of weight, distance and the parameters, under names.  False if it
+        // could not be written.
+        bool write(const string& filename, const vector<string>& names, const string& params_json) const {
+            vector<string> columns = {"weight", "distance"};
+            columns.insert(columns.end(), names.begin(), names.end());
+            vector<uint32_t> types(columns.size(), DAILY_FLOAT64);
+            return write_binary_columns(filename, params_json, columns, types, size(), [&](uint32_t c, void* out) {
+                double* values = (double*) out;
+                for (size_t i = 0; i < size(); i++) {
+                    values[i] = c == 0 ? weights[i] : c == 1 ? distances[i] : theta[i][c - 2];
+                }
+            });
+        }
+};
+
+#endif
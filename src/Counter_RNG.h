@@ -0,0 +1,68 @@
+#ifndef COUNTER_RNG_H
+#define COUNTER_RNG_H
+
+#include <cstdint>
+
+// Philox4x32-10 counter-based generator (Salmon et al. 2011, "Parallel random
+// numbers: as easy as 1, 2, 3").  The output is a pure function of
+// (key, stream, position), so a stream costs nothing to create and any
+// number of independent streams can be drawn from one key.  Satisfies the
+// UniformRandomBitGenerator requirements, so it works with the <random>
+// distributions and the rand_* helpers in Utility.h.
+class Philox4x32 {
+        uint32_t key[2];
+        uint32_t ctr[4];            // ctr[0..1]: block within stream, ctr[2..3]: stream id
+        uint32_t out[4];
+        int idx;
+
+        static inline void mulhilo(uint32_t a, uint32_t b, uint32_t& hi, uint32_t& lo) {
+            uint64_t p = (uint64_t) a * b;
+            hi = (uint32_t) (p >> 32);
+            lo = (uint32_t) p;
+        }
+
+        void generate() {
+            uint32_t c[4] = {ctr[0], ctr[1], ctr[2], ctr[3]};
+            uint32_t k[2] = {key[0], key[1]};
+            for (int r = 0; r < 10; r++) {
+                if (r > 0) {
+                    k[0] += 0x9E3779B9;
+                    k[1] += 0xBB67AE85;
+                }
+                uint32_t hi0, lo0, hi1, lo1;
+                mulhilo(0xD2511F53, c[0], hi0, lo0);
+                mulhilo(0xCD9E8D57, c[2], hi1, lo1);
+                c[0] = hi1 ^ c[1] ^ k[0];
+                c[1] = lo1;
+                c[2] = hi0 ^ c[3] ^ k[1];
+                c[3] = lo0;
+            }
+            for (int i = 0; i < 4; i++) out[i] = c[i];
+            if (++ctr[0] == 0) ++ctr[1];
+        }
+
+    public:
+        typedef uint32_t result_type;
+
+        Philox4x32(uint64_t k, uint64_t stream) : idx(4) {
+            key[0] = (uint32_t) k;
+            key[1] = (uint32_t) (k >> 32);
+            ctr[0] = 0;
+            ctr[1] = 0;
+            ctr[2] = (uint32_t) stream;
+            ctr[3] = (uint32_t) (stream >> 32);
+        }
+
+        static constexpr result_type min() { return 0; }
+        static constexpr result_type max() { return UINT32_MAX; }
+
+        result_type operator()() {
+            if (idx == 4) {
+                generate();
+                idx = 0;
+            }
+            return out[idx++];
+        }
+};
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef DAILY_OUTPUT_H
+#define DAILY_OUTPUT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <functional>
+#include "NUCOVID_cereal.h"
+#include "Quantile_Sketch.h"
+#include <cereal/types/map.hpp>
+#include <cereal/types/utility.hpp>
+
+#if defined(__BYTE_ORDER__) and __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "the binary daily output is written in host byte order, which must be little-endian"
+#endif
+
+using namespace std;
+
+// Binary columnar form of the daily output, for ensembles too large to go
+// through text.  All numbers are little-endian:
+//
+//     magic "NUCOVIDB"                         8 bytes
+//     format version (1)                       uint32
+//     number of columns c                      uint32
+//     number of rows n                         uint64
+//     length p of the parameters               uint64
+//     the run's parameters, as JSON            p bytes
+//     c times: type (0 int32, 1 float64)       uint32
+//              length l of the name            uint32
+//              the column's name               l bytes
+//              offset of its n values          uint64
+//     the columns
+//
+// Columns start at multiples of 8 bytes from the start of the file, and
+// the file is padded to a multiple of 8 bytes, so the whole file can be
+// mapped as int32 or as float64 and each column read off it in place (see
+// read_covid_age_binary() in R/covid_age_wrapper.R).  Ki is float64, the
+// other columns int32.  Other tables, e.g. the particle populations of
+// ABC_SMC.h, are written in the same format.
+
+const char DAILY_BINARY_MAGIC[8] = {'N', 'U', 'C', 'O', 'V', 'I', 'D', 'B'};
+const uint32_t DAILY_BINARY_VERSION = 1;
+enum { DAILY_INT32 = 0, DAILY_FLOAT64 = 1 };
+
+// Write nrows rows of the columns names, of types DAILY_INT32 or
+// DAILY_FLOAT64, to filename in the format above, with params_json in the
+// header; column(c, values) fills values with column c.  False if the file
+// could not be written.
+inline bool write_binary_columns(const string& filename, const string& params_json, const vector<string>& names,
+                                 const vector<uint32_t>& types, uint64_t nrows,
+                                 const function<void(uint32_t c, void* values)>& column) {
+    const uint32_t ncols = names.size();
+    const uint64_t plen = params_json.size();
+
+    auto pad8 = [](uint64_t n) { return (n + 7) / 8 * 8; };
+    uint64_t offset = 8 + 4 + 4 + 8 + 8 + plen;
+    for (const auto& name : names) offset += 4 + 4 + name.size() + 8;
+    vector<uint64_t> offsets;
+    for (uint32_t c = 0; c < ncols; c++) {
+        offset = pad8(offset);
+        offsets.push_back(offset);
+        offset += nrows * (types[c] == DAILY_FLOAT64 ? 8 : 4);
+    }
+    const uint64_t file_size = pad8(offset);
+
+    ofstream file(filename, ios::binary);
+    if (not file.is_open()) {
+        cerr << "ERROR: Could not open daily buffer file for output: " << filename << endl;
+        return false;
+    }
+    uint64_t written = 0;
+    auto put = [&](const void* p, size_t n) {
+        file.write((const char*) p, n);
+        written += n;
+    };
+    auto pad_to = [&](uint64_t pos) {
+        static const char zeros[8] = {0};
+        put(zeros, pos - written);
+    };
+
+    put(DAILY_BINARY_MAGIC, 8);
+    put(&DAILY_BINARY_VERSION, 4);
+    put(&ncols, 4);
+    put(&nrows, 8);
+    put(&plen, 8);
+    put(params_json.data(), plen);
+    for (uint32_t c = 0; c < ncols; c++) {
+        const uint32_t len = names[c].size();
+        put(&types[c], 4);
+        put(&len, 4);
+        put(names[c].data(), len);
+        put(&offsets[c], 8);
+    }
+    vector<char> values;
+    for (uint32_t c = 0; c < ncols; c++) {
+        pad_to(offsets[c]);
+        values.resize(nrows * (types[c] == DAILY_FLOAT64 ? 8 : 4));
+        column(c, values.data());
+        put(values.data(), values.size());
+    }
+    pad_to(file_size);
+    file.close();
+    if (file.fail()) {
+        cerr << "ERROR: Could not write daily output file: " << filename << endl;
+        return false;
+    }
+    return true;
+}
+
+// Write rows to filename, with params_json in the header and, if serials is
+// given, each row's serial as a leading "serial" column, and if stopped is,
+// a trailing "stopped" column (see run_stopping() in chicago_yr1).  False if
+// the file could not be written.
+inline bool write_daily_binary(const vector<DailyState>& rows, const string& filename, const string& params_json,
+                               const vector<int>* serials = NULL, const vector<int>* stopped = NULL) {
+    vector<string> names;
+    if (serials) names.push_back("serial");
+    names.insert(names.end(), DAILY_COLUMN_NAMES, DAILY_COLUMN_NAMES + DAILY_COLUMNS);
+    if (stopped) names.push_back("stopped");
+    vector<uint32_t> types;
+    for (const auto& name : names) types.push_back(name == "Ki" ? DAILY_FLOAT64 : DAILY_INT32);
+    const uint64_t nrows = rows.size();
+
+    return write_binary_columns(filename, params_json, names, types, nrows, [&](uint32_t c, void* out) {
+        const int col = serials ? (int) c - 1 : (int) c;     // column of the daily output
+        if (types[c] == DAILY_FLOAT64) {
+            double* values = (double*) out;
+            for (uint64_t r = 0; r < nrows; r++) values[r] = rows[r].Ki;
+            return;
+        }
+        int32_t* values = (int32_t*) out;
+        for (uint64_t r = 0; r < nrows; r++) {
+            const DailyState& ds = rows[r];
+            values[r] = col < 0 ? (*serials)[r] : col == DAILY_COLUMNS ? (*stopped)[r]
+                        : col == 0 ? ds.node : col == 1 ? ds.day : ds.counts[col - 3];
+        }
+    });
+}
+
+// Quantiles across the replicates of an ensemble of each count column of
+// the daily output, per node and day, gathered as replicates finish, in
+// memory independent of their number (see QuantileSketch, of which k is
+// the size).  Summaries of parts of an ensemble, e.g. on several machines,
+// merge into that of the whole.
+class DailySummary {
+        struct Cell {
+            vector<QuantileSketch> sketches;    // per count column
+            vector<double> sums;
+
+            template<class Archive>
+            void serialize(Archive & archive) {
+                archive( sketches, sums );
+            }
+        };
+        int k;
+        map<pair<int, int>, Cell> cells;        // by (node, day)
+
+        Cell& cell(int node, int day) {
+            auto it = cells.find(make_pair(node, day));
+            if (it != cells.end()) return it->second;
+            Cell& c = cells[make_pair(node, day)];
+            c.sketches.assign(DS_COUNTS, QuantileSketch(k));
+            c.sums.assign(DS_COUNTS, 0);
+            return c;
+        }
+
+    public:
+        template<class Archive>
+        void serialize(Archive & archive) {
+            archive( k, cells );
+        }
+
+        DailySummary(int k_ = 200) : k(k_) {}
+
+        // the daily output of one replicate
+        void add(const vector<DailyState>& rows) {
+            for (const DailyState& ds : rows) {
+                Cell& c = cell(ds.node, ds.day);
+                for (int col = 0; col < DS_COUNTS; col++) {
+                    c.sketches[col].add(ds.counts[col]);
+                    c.sums[col] += ds.counts[col];
+                }
+            }
+        }
+
+        void merge(const DailySummary& other) {
+            for (const auto& el : other.cells) {
+                Cell& c = cell(el.first.first, el.first.second);
+                for (int col = 0; col < DS_COUNTS; col++) {
+                    c.sketches[col].merge(el.second.sketches[col]);
+                    c.sums[col] += el.second.sums[col];
+                }
+            }
+        }
+
+        // Write a table of node, time, column, replicates, mean and the
+        // quantiles at probabilities ps, one line per node, day and column.
+        bool write(const string& filename, const vector<double>& ps) const {
+            StreamWriter file(filename, true);
+            stringstream header;
+            header << "node\ttime\tcolumn\tn\tmean";
+            for (double p : ps) header << "\tq" << p;
+            file.write(header.str());
+            for (const auto& el : cells) {
+                for (int col = 0; col < DS_COUNTS; col++) {
+                    const QuantileSketch& sketch = el.second.sketches[col];
+                    stringstream ss;
+                    ss << setprecision(8) << el.first.first << "\t" << el.first.second << "\t" << DAILY_COLUMN_NAMES[col + 3]
+                       << "\t" << sketch.count() << "\t" << el.second.sums[col] / sketch.count();
+                    for (double q : sketch.quantiles(ps)) ss << "\t" << q;
+                    file.write(ss.str());
+                }
+            }
+            return file.close();
+        }
+};
+
+#endif
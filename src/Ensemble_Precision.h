@@ -0,0 +1,120 @@
+#ifndef ENSEMBLE_PRECISION_H
+#define ENSEMBLE_PRECISION_H
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include "json.hpp"
+#include "NUCOVID_cereal.h"
+
+using namespace std;
+
+// A precision target of an ensemble: the 95% confidence interval of a
+// statistic across replicates, at most width wide.  The statistic is of one
+// count column of the daily output, totalled over the nodes, on day (or
+// the run's last day, if it ended before), or at its peak over the run if
+// day is -1; across replicates it is the mean (quantile -1), with a normal
+// interval, or the quantile, with the distribution-free interval of order
+// statistics.  With relative, width is a fraction of the estimate.
+struct PrecisionTarget {
+    int column;             // index into DailyState::counts
+    int day;
+    double quantile;
+    double width;
+    bool relative;
+
+    // this replicate's value of the statistic
+    double value(const vector<DailyState>& rows) const {
+        double peak = 0, at_day = 0, total = 0;
+        int current = rows.empty() ? 0 : rows[0].day;
+        for (const DailyState& ds : rows) {
+            if (ds.day != current) {
+                peak = max(peak, total);
+                if (current <= day) at_day = total;
+                total = 0;
+                current = ds.day;
+            }
+            total += ds.counts[column];
+        }
+        peak = max(peak, total);
+        if (current <= day) at_day = total;
+        return day < 0 ? peak : at_day;
+    }
+
+    // the estimate and its interval, from the values of the replicates so
+    // far; with fewer than two there is no spread to go by, and the interval
+    // is infinite
+    void interval(vector<double> values, double& estimate, double& low, double& high) const {
+        const double z = 1.96;
+        const size_t n = values.size();
+        if (n < 2) {
+            estimate = n == 1 ? values[0] : NAN;
+            low = -INFINITY;
+            high = INFINITY;
+            return;
+        }
+        if (quantile < 0) {
+            double mean = 0, var = 0;
+            for (double v : values) mean += v / n;
+            for (double v : values) var += (v - mean) * (v - mean) / (n - 1);
+            estimate = mean;
+            low = mean - z * sqrt(var / n);
+            high = mean + z * sqrt(var / n);
+            return;
+        }
+        sort(values.begin(), values.end());
+        const double h = (n - 1) * quantile;
+        estimate = values[floor(h)] + (h - floor(h)) * (values[ceil(h)] - values[floor(h)]);
+        // ranks n q -/+ z sqrt(n q (1 - q)), counted from 1
+        const double spread = z * sqrt(n * quantile * (1 - quantile));
+        const double lo_rank = floor(n * quantile - spread);
+        const double hi_rank = ceil(n * quantile + spread) + 1;
+        low = lo_rank < 1 ? -INFINITY : values[lo_rank - 1];
+        high = hi_rank > n ? INFINITY : values[hi_rank - 1];
+    }
+
+    // whether an interval is narrow enough
+    bool met(double estimate, double low, double high) const {
+        return high - low <= (relative ? width * fabs(estimate) : width);
+    }
+
+    string name() const {
+        string s = quantile < 0 ? "mean" : "q" + to_string(quantile).substr(0, 5);
+        s += string(" ") + DAILY_COLUMN_NAMES[column + 3];
+        return s + (day < 0 ? " at peak" : " on day " + to_string(day));
+    }
+};
+
+// params["precision_targets"] = [[column, day, quantile, width], ...], day
+// null for the peak and quantile null for the mean, read into targets, or -1
+inline int read_precision_targets(const nlohmann::json& params, vector<PrecisionTarget>& targets) {
+    const nlohmann::json& ts = params["precision_targets"];
+    bool valid = ts.is_array() and not ts.empty();
+    for (const auto& t : ts) {
+        if (not valid) break;
+        PrecisionTarget target;
+        target.column = -1;
+        if (t.is_array() and t.size() == 4 and t[0].is_string()) {
+            for (int c = 0; c < DS_COUNTS; c++) if (DAILY_COLUMN_NAMES[c + 3] == t[0].get<string>()) target.column = c;
+        }
+        valid = target.column >= 0 and (t[1] == nullptr or t[1].is_number_integer())
+                and (t[2] == nullptr or (t[2].is_number() and t[2] > 0 and t[2] < 1))
+                and t[3].is_number() and t[3] > 0;
+        if (not valid) break;
+        target.day = t[1] == nullptr ? -1 : t[1].get<int>();
+        target.quantile = t[2] == nullptr ? -1 : t[2].get<double>();
+        target.width = t[3];
+        target.relative = params["precision_relative"] == true;
+        targets.push_back(target);
+    }
+    if (not valid) {
+        std::cerr << "Invalid precision_targets: " << ts
+                  << " ([[count column, day or null for the peak, quantile or null for the mean, width], ...])" << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+#endif
@@ -107,9 +107,23 @@ class Event {
         Node* source_node;
         Node* target_node;
         bool detect;
-        Event(const Event& o) {  time=o.time; type=o.type; source_node=o.source_node; target_node=o.target_node; detect=o.detect;}
-        Event(double t, eventType e, Node* sn, Node* tn, bool det) {time=t; type=e; source_node=sn; target_node=tn; detect=det;}
-        Event& operator=(const Event& o) { time=o.time; type=o.type; source_node=o.source_node; target_node=o.target_node; detect=o.detect; return *this; }
+        int contact_id;             // ContactProcess that drew this CON event (-1 if pre-scheduled)
+        Event(const Event& o) {  time=o.time; type=o.type; source_node=o.source_node; target_node=o.target_node; detect=o.detect; contact_id=o.contact_id;}
+        Event(double t, eventType e, Node* sn, Node* tn, bool det, int cid = -1) {time=t; type=e; source_node=sn; target_node=tn; detect=det; contact_id=cid;}
+        Event& operator=(const Event& o) { time=o.time; type=o.type; source_node=o.source_node; target_node=o.target_node; detect=o.detect; contact_id=o.contact_id; return *this; }
+};
+
+// Remaining contact schedule of one infectious individual.  With lazy
+// contacts only the next CON event is queued; the following one is drawn
+// from this state when that event fires.
+class ContactProcess {
+    public:
+        Node* node;
+        double Tr;                  // time of recovery/death, no contacts after this
+        bool detect;
+        size_t bin;                 // current index into Times/Ki_modifier
+        vector<double> Times;       // start times of the infectiousness bins
+        vector<double> Ki_modifier; // infectiousness multiplier for each bin
 };
 
 class compTime {
@@ -130,8 +144,11 @@ class Event_Driven_NUCOVID {
         priority_queue<Event, vector<Event>, compTime > EventQ; // event queue
         double Now;                 // Current "time" in simulation
         mt19937 rng;              // RNG
+        bool lazy_contacts;         // draw contacts one at a time instead of all at infection
+        vector<ContactProcess> contacts;    // active contact processes (lazy mode)
+        vector<int> free_contacts;          // reusable slots in contacts
         
-        Event_Driven_NUCOVID (vector<Node*> ns, vector<vector<double>> mat) {
+        Event_Driven_NUCOVID (vector<Node*> ns, vector<vector<double>> mat) : lazy_contacts(false) {
             nodes = ns;
             infection_matrix = mat;
             
@@ -202,6 +219,8 @@ class Event_Driven_NUCOVID {
                 nodes[i]->reset();
             }
             EventQ = priority_queue<Event, vector<Event>, compTime > ();
+            contacts.clear();
+            free_contacts.clear();
         }
 
         void rand_infect(int k, Node* n) {   // randomly infect k people
@@ -382,6 +401,10 @@ class Event_Driven_NUCOVID {
             }
             
             // time to next contact
+            if (lazy_contacts) {
+                start_contacts(n, Times, Ki_modifier, Tr, det_flag);
+                return;
+            }
             int bin = 0;
             double Tc = rand_exp(n->get_Ki((int) Ti) * Ki_modifier[bin], &rng) + Ti;
             while ( Tc < Tr ) {     // does contact occur before recovery?
@@ -398,6 +421,47 @@ class Event_Driven_NUCOVID {
             //return;
         }
 
+        // Lazy counterpart of the contact loop in infect(): queue only the first
+        // contact and keep what is needed to draw the rest in a ContactProcess.
+        void start_contacts(Node* n, vector<double>& Times, vector<double>& Ki_modifier, double Tr, bool det_flag) {
+            double Tc = rand_exp(n->get_Ki((int) Times[0]) * Ki_modifier[0], &rng) + Times[0];
+            if (Tc >= Tr) return;   // recovers before the first contact
+
+            int cid;
+            if (free_contacts.empty()) {
+                cid = contacts.size();
+                contacts.push_back(ContactProcess());
+            } else {
+                cid = free_contacts.back();
+                free_contacts.pop_back();
+            }
+            ContactProcess& cp = contacts[cid];
+            cp.node = n;
+            cp.Tr = Tr;
+            cp.detect = det_flag;
+            cp.bin = 0;
+            cp.Times.swap(Times);
+            cp.Ki_modifier.swap(Ki_modifier);
+
+            size_t infect_node_id = get_infection_node_id(n->id);
+            add_event(Tc, CON, n, nodes[infect_node_id], det_flag, cid);
+        }
+
+        // Called when the CON event of contact process cid fires at time Now.
+        void next_contact(int cid) {
+            ContactProcess& cp = contacts[cid];
+            double Tc = Now;
+            while (cp.bin < cp.Times.size() - 1 and cp.Times[cp.bin+1] < Tc) {cp.bin++;} // update bin if necessary
+            Tc += rand_exp(cp.node->get_Ki((int) Tc) * cp.Ki_modifier[cp.bin], &rng);
+            if (Tc < cp.Tr) {
+                size_t infect_node_id = get_infection_node_id(cp.node->id);
+                add_event(Tc, CON, cp.node, nodes[infect_node_id], cp.detect, cid);
+            } else {
+                cp.node = NULL;
+                free_contacts.push_back(cid);
+            }
+        }
+
         int next_event() {
             if ( EventQ.empty() ) return 0;
             Event event = EventQ.top(); // get the element
@@ -468,6 +532,7 @@ class Event_Driven_NUCOVID {
                             if (not event.target_node->id == event.source_node->id) event.target_node->introduced++;
                             infect(event.target_node);
                         }
+                        if (event.contact_id >= 0) next_contact(event.contact_id);
                     }
                     break;
                 default:    
@@ -476,8 +541,8 @@ class Event_Driven_NUCOVID {
             return 1;
         }
 
-        void add_event( double time, eventType type, Node* sn, Node* tn, bool detect) {
-            EventQ.push( Event(time,type,sn,tn,detect) );
+        void add_event( double time, eventType type, Node* sn, Node* tn, bool detect, int contact_id = -1) {
+            EventQ.push( Event(time,type,sn,tn,detect,contact_id) );
             return;
         }
 
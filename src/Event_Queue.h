@@ -0,0 +1,511 @@
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <climits>
+#include <cmath>
+#include <iostream>
+#include <cereal/types/vector.hpp>
+#include "Utility.h"
+
+using namespace std;
+
+// Event queue backends used by the event driven simulators.
+//
+// T needs a non-negative double member "time"; Comp(a, b) is true when a
+// fires after b (as for std::priority_queue).  Comp must be a strict total
+// order on distinct events: then every backend pops events in exactly the
+// same sequence, and trajectories do not depend on the backend chosen.
+
+typedef enum {
+    BINARY_HEAP,
+    DARY_HEAP,
+    CALENDAR_QUEUE,
+    RADIX_HEAP
+} queueType;
+
+// compile time default, e.g. -DNUCOVID_EVENT_QUEUE=CALENDAR_QUEUE
+#ifndef NUCOVID_EVENT_QUEUE
+#define NUCOVID_EVENT_QUEUE BINARY_HEAP
+#endif
+
+inline bool parse_queue_type(const string& name, queueType& qtype) {
+    if (name == "binary")        qtype = BINARY_HEAP;
+    else if (name == "dary")     qtype = DARY_HEAP;
+    else if (name == "calendar") qtype = CALENDAR_QUEUE;
+    else if (name == "radix")    qtype = RADIX_HEAP;
+    else return false;
+    return true;
+}
+
+
+// std::push_heap/pop_heap on a vector
+template<typename T, typename Comp>
+class BinaryHeap {
+        vector<T> heap;
+        Comp comp;
+
+    public:
+        bool empty() const { return heap.empty(); }
+        size_t size() const { return heap.size(); }
+        const T& top() { return heap.front(); }
+
+        void push(const T& e) {
+            heap.push_back(e);
+            push_heap(heap.begin(), heap.end(), comp);
+        }
+
+        void push_bulk(const vector<T>& batch) {
+            if (batch.size() > heap.size()) {
+                heap.insert(heap.end(), batch.begin(), batch.end());
+                make_heap(heap.begin(), heap.end(), comp);
+            } else {
+                for (const auto& e : batch) push(e);
+            }
+        }
+
+        T pop() {
+            pop_heap(heap.begin(), heap.end(), comp);
+            T e = std::move(heap.back());
+            heap.pop_back();
+            return e;
+        }
+
+        void clear() { heap.clear(); }
+        void dump(vector<T>& out) const { out.insert(out.end(), heap.begin(), heap.end()); }
+};
+
+
+// D-ary heap: shallower than a binary heap and the children of a node share
+// a cache line, so sift-down does fewer misses for D = 4.
+template<typename T, typename Comp, size_t D = 4>
+class DAryHeap {
+        vector<T> heap;
+        Comp comp;
+
+        void sift_up(size_t i) {
+            T e = heap[i];
+            while (i > 0) {
+                size_t p = (i - 1) / D;
+                if (not comp(heap[p], e)) break;
+                heap[i] = heap[p];
+                i = p;
+            }
+            heap[i] = e;
+        }
+
+        void sift_down(size_t i, const T e) {
+            const size_t n = heap.size();
+            while (true) {
+                size_t c = D * i + 1;
+                if (c >= n) break;
+                size_t best = c;
+                size_t end = MIN(c + D, n);
+                for (size_t j = c + 1; j < end; j++) {
+                    if (comp(heap[best], heap[j])) best = j;
+                }
+                if (not comp(e, heap[best])) break;
+                heap[i] = heap[best];
+                i = best;
+            }
+            heap[i] = e;
+        }
+
+    public:
+        bool empty() const { return heap.empty(); }
+        size_t size() const { return heap.size(); }
+        const T& top() { return heap.front(); }
+
+        void push(const T& e) {
+            heap.push_back(e);
+            sift_up(heap.size() - 1);
+        }
+
+        void push_bulk(const vector<T>& batch) {
+            if (batch.size() > heap.size()) {
+                heap.insert(heap.end(), batch.begin(), batch.end());
+                if (heap.size() < 2) return;
+                for (size_t i = (heap.size() - 2) / D + 1; i-- > 0; ) sift_down(i, heap[i]);
+            } else {
+                for (const auto& e : batch) push(e);
+            }
+        }
+
+        T pop() {
+            T e = heap.front();
+            T last = heap.back();
+            heap.pop_back();
+            if (not heap.empty()) sift_down(0, last);
+            return e;
+        }
+
+        void clear() { heap.clear(); }
+        void dump(vector<T>& out) const { out.insert(out.end(), heap.begin(), heap.end()); }
+};
+
+
+// Calendar queue with one bucket per simulated day.  Only the current day is
+// kept as a heap; later days are unsorted buckets in a ring and are heapified
+// when the simulation reaches them.  Events beyond the ring go to a small
+// overflow heap.
+template<typename T, typename Comp>
+class CalendarQueue {
+        static const long WIDTH = 1024;     // days covered by the ring
+
+        vector<T> today;            // heap of events with day <= cur_day
+        vector<vector<T>> ring;     // ring[d % WIDTH]: events of day d, cur_day < d < cur_day + WIDTH
+        vector<T> far;              // heap of events at or beyond the ring at push time
+        long cur_day;
+        size_t ring_count;
+        size_t n;
+        Comp comp;
+
+        static long day_of(double t) { return t < (double) LONG_MAX / 2 ? (long) floor(t) : LONG_MAX / 2; }
+        static size_t slot(long d) { return ((d % WIDTH) + WIDTH) % WIDTH; }
+
+        // make sure "today" holds the earliest events, if there are any
+        void settle() {
+            while (today.empty() and n > 0) {
+                if (ring_count == 0) {
+                    cur_day = day_of(far.front().time);
+                } else {
+                    cur_day++;
+                }
+                today.swap(ring[slot(cur_day)]);
+                ring_count -= today.size();
+                while (not far.empty() and day_of(far.front().time) <= cur_day) {
+                    pop_heap(far.begin(), far.end(), comp);
+                    today.push_back(far.back());
+                    far.pop_back();
+                }
+                make_heap(today.begin(), today.end(), comp);
+            }
+        }
+
+    public:
+        CalendarQueue() : ring(WIDTH), cur_day(0), ring_count(0), n(0) {}
+
+        bool empty() const { return n == 0; }
+        size_t size() const { return n; }
+        const T& top() { settle(); return today.front(); }
+
+        void push(const T& e) {
+            long d = day_of(e.time);
+            if (n == 0) cur_day = d;
+            n++;
+            if (d <= cur_day) {
+                today.push_back(e);
+                push_heap(today.begin(), today.end(), comp);
+            } else if (d - cur_day < WIDTH) {
+                ring[slot(d)].push_back(e);
+                ring_count++;
+            } else {
+                far.push_back(e);
+                push_heap(far.begin(), far.end(), comp);
+            }
+        }
+
+        void push_bulk(const vector<T>& batch) { for (const auto& e : batch) push(e); }
+
+        T pop() {
+            settle();
+            pop_heap(today.begin(), today.end(), comp);
+            T e = std::move(today.back());
+            today.pop_back();
+            n--;
+            return e;
+        }
+
+        void clear() {
+            today.clear();
+            far.clear();
+            for (auto& b : ring) b.clear();
+            ring_count = 0;
+            n = 0;
+        }
+
+        void dump(vector<T>& out) const {
+            out.insert(out.end(), today.begin(), today.end());
+            for (const auto& b : ring) out.insert(out.end(), b.begin(), b.end());
+            out.insert(out.end(), far.begin(), far.end());
+        }
+};
+
+
+// Monotone radix heap keyed on the bit pattern of the (non-negative) event
+// time.  Requires that no event is pushed earlier than the last one popped,
+// which holds because simulated time only moves forward.
+template<typename T, typename Comp>
+class RadixHeap {
+        static const int NBUCKETS = 65;
+
+        vector<T> buckets[NBUCKETS];    // buckets[i]: key differs from last in bit i-1 (highest)
+        uint64_t last;                  // key of the last event popped
+        size_t n;
+        int top_bucket;                 // where the earliest event is, once found
+        size_t best;
+        bool found;
+        Comp comp;
+
+        static uint64_t key(double t) { uint64_t k; memcpy(&k, &t, sizeof(k)); return k; }
+        int bucket_of(uint64_t k) const { return k == last ? 0 : 64 - __builtin_clzll(k ^ last); }
+
+        // Find the earliest event, in the lowest bucket that has any, without
+        // moving last: events between the last popped and the earliest one
+        // can still be pushed.  Events with equal times are ordered by comp.
+        void find_top() {
+            if (found) return;
+            top_bucket = 0;
+            while (buckets[top_bucket].empty()) top_bucket++;
+            const vector<T>& b = buckets[top_bucket];
+            best = 0;
+            for (size_t j = 1; j < b.size(); j++) {
+                if (comp(b[best], b[j])) best = j;
+            }
+            found = true;
+        }
+
+    public:
+        RadixHeap() : last(0), n(0), top_bucket(0), best(0), found(false) {}
+
+        bool empty() const { return n == 0; }
+        size_t size() const { return n; }
+        const T& top() { find_top(); return buckets[top_bucket][best]; }
+
+        void push(const T& e) {
+            if (e.time < 0 or key(e.time) < last) {
+                cerr << "ERROR: RadixHeap requires event times not earlier than the last popped event\n";
+                exit(-1);
+            }
+            if (found and comp(buckets[top_bucket][best], e)) found = false;
+            buckets[bucket_of(key(e.time))].push_back(e);
+            n++;
+        }
+
+        void push_bulk(const vector<T>& batch) { for (const auto& e : batch) push(e); }
+
+        T pop() {
+            find_top();
+            if (top_bucket > 0) {
+                // the earliest event's key becomes last, and its bucket spreads over lower ones
+                vector<T> b;
+                b.swap(buckets[top_bucket]);
+                last = key(b[best].time);
+                for (const auto& e : b) buckets[bucket_of(key(e.time))].push_back(e);
+                found = false;
+                find_top();
+            }
+            T e = buckets[0][best];
+            buckets[0][best] = buckets[0].back();
+            buckets[0].pop_back();
+            n--;
+            found = false;
+            return e;
+        }
+
+        void clear() {
+            for (int i = 0; i < NBUCKETS; i++) buckets[i].clear();
+            last = 0;
+            n = 0;
+            found = false;
+        }
+
+        void dump(vector<T>& out) const {
+            for (int i = 0; i < NBUCKETS; i++) out.insert(out.end(), buckets[i].begin(), buckets[i].end());
+        }
+};
+
+
+// Indexed binary min-heap of the next firing times of reactions 0..n-1
+// (Gibson & Bruck 2000): the time of any reaction can be changed in
+// O(log n) when its rate changes, and add() appends reaction n.  INFINITY
+// means never.
+class IndexedMinHeap {
+        vector<double> times;       // by reaction
+        vector<size_t> heap;        // reactions, heap ordered by time
+        vector<size_t> pos;         // index of each reaction in heap
+
+        void swap_nodes(size_t a, size_t b) {
+            std::swap(heap[a], heap[b]);
+            pos[heap[a]] = a;
+            pos[heap[b]] = b;
+        }
+
+        void sift_up(size_t k) {
+            while (k > 0 and times[heap[k]] < times[heap[(k - 1) / 2]]) {
+                swap_nodes(k, (k - 1) / 2);
+                k = (k - 1) / 2;
+            }
+        }
+
+        void sift_down(size_t k) {
+            while (true) {
+                size_t best = k;
+                for (size_t c = 2*k + 1; c <= 2*k + 2 and c < heap.size(); c++) {
+                    if (times[heap[c]] < times[heap[best]]) best = c;
+                }
+                if (best == k) return;
+                swap_nodes(k, best);
+                k = best;
+            }
+        }
+
+    public:
+        IndexedMinHeap(size_t n = 0) { reset(n); }
+
+        void reset(size_t n) {
+            times.assign(n, INFINITY);
+            heap.resize(n);
+            pos.resize(n);
+            for (size_t i = 0; i < n; i++) heap[i] = pos[i] = i;
+        }
+
+        // a new reaction at time t; returns its index
+        size_t add(double t) {
+            const size_t i = times.size();
+            times.push_back(t);
+            pos.push_back(heap.size());
+            heap.push_back(i);
+            sift_up(pos[i]);
+            return i;
+        }
+
+        size_t size() const { return heap.size(); }
+        size_t top() const { return heap[0]; }
+        double top_time() const { return heap.empty() ? INFINITY : times[heap[0]]; }
+        double time(size_t i) const { return times[i]; }
+
+        void update(size_t i, double t) {
+            const double old = times[i];
+            times[i] = t;
+            if (t < old) sift_up(pos[i]);
+            else sift_down(pos[i]);
+        }
+};
+
+
+// Scheduler used by the simulators; the backend can be chosen at run time
+// with set_type() or at compile time through NUCOVID_EVENT_QUEUE.
+template<typename T, typename Comp>
+class EventScheduler {
+        queueType qtype;
+        BinaryHeap<T, Comp> binary;
+        DAryHeap<T, Comp> dary;
+        CalendarQueue<T, Comp> calendar;
+        RadixHeap<T, Comp> radix;
+
+    public:
+        EventScheduler() : qtype(NUCOVID_EVENT_QUEUE) {}
+
+        queueType type() const { return qtype; }
+
+        // switch backend, carrying over any queued events
+        void set_type(queueType qt) {
+            if (qt == qtype) return;
+            vector<T> events;
+            dump(events);
+            clear();
+            qtype = qt;
+            push_bulk(events);
+        }
+
+        bool empty() const {
+            switch (qtype) {
+                case DARY_HEAP:      return dary.empty();
+                case CALENDAR_QUEUE: return calendar.empty();
+                case RADIX_HEAP:     return radix.empty();
+                default:             return binary.empty();
+            }
+        }
+
+        size_t size() const {
+            switch (qtype) {
+                case DARY_HEAP:      return dary.size();
+                case CALENDAR_QUEUE: return calendar.size();
+                case RADIX_HEAP:     return radix.size();
+                default:             return binary.size();
+            }
+        }
+
+        const T& top() {
+            switch (qtype) {
+                case DARY_HEAP:      return dary.top();
+                case CALENDAR_QUEUE: return calendar.top();
+                case RADIX_HEAP:     return radix.top();
+                default:             return binary.top();
+            }
+        }
+
+        void push(const T& e) {
+            switch (qtype) {
+                case DARY_HEAP:      dary.push(e); break;
+                case CALENDAR_QUEUE: calendar.push(e); break;
+                case RADIX_HEAP:     radix.push(e); break;
+                default:             binary.push(e);
+            }
+        }
+
+        void push_bulk(const vector<T>& batch) {
+            switch (qtype) {
+                case DARY_HEAP:      dary.push_bulk(batch); break;
+                case CALENDAR_QUEUE: calendar.push_bulk(batch); break;
+                case RADIX_HEAP:     radix.push_bulk(batch); break;
+                default:             binary.push_bulk(batch);
+            }
+        }
+
+        // e.g. straight out of a memory-mapped checkpoint
+        void push_bulk(const T* first, const T* last) {
+            vector<T> batch(first, last);
+            push_bulk(batch);
+        }
+
+        T pop() {
+            switch (qtype) {
+                case DARY_HEAP:      return dary.pop();
+                case CALENDAR_QUEUE: return calendar.pop();
+                case RADIX_HEAP:     return radix.pop();
+                default:             return binary.pop();
+            }
+        }
+
+        void clear() {
+            binary.clear();
+            dary.clear();
+            calendar.clear();
+            radix.clear();
+        }
+
+        void dump(vector<T>& out) const {
+            switch (qtype) {
+                case DARY_HEAP:      dary.dump(out); break;
+                case CALENDAR_QUEUE: calendar.dump(out); break;
+                case RADIX_HEAP:     radix.dump(out); break;
+                default:             binary.dump(out);
+            }
+        }
+
+        template<class Archive>
+        void save(Archive & archive) const {
+            vector<T> events;
+            dump(events);
+            int qt = qtype;
+            archive( qt, events );
+        }
+
+        template<class Archive>
+        void load(Archive & archive) {
+            vector<T> events;
+            int qt;
+            archive( qt, events );
+            clear();
+            qtype = (queueType) qt;
+            push_bulk(events);
+        }
+};
+
+#endif
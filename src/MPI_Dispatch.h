@@ -0,0 +1,147 @@
+#ifndef MPI_DISPATCH_H
+#define MPI_DISPATCH_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <mpi.h>
+#include <cereal/archives/binary.hpp>
+
+using namespace std;
+
+// Work spread over the ranks of MPI_COMM_WORLD, for ensembles and
+// calibrations larger than one machine.  Rank 0 hands out work units one at
+// a time to whichever rank asks next, so faster ranks take more of them,
+// and results come back to it over MPI rather than through files.  Results
+// are byte strings, e.g. cereal archives made with to_bytes().
+
+enum { MPI_TAG_READY = 1, MPI_TAG_RESULT, MPI_TAG_UNIT, MPI_TAG_DONE };
+
+template <typename... T>
+string to_bytes(T&... values) {
+    stringstream ss;
+    {
+        cereal::BinaryOutputArchive archive(ss);
+        archive(values...);
+    }
+    return ss.str();
+}
+
+template <typename... T>
+void from_bytes(const string& bytes, T&... values) {
+    stringstream ss(bytes);
+    cereal::BinaryInputArchive archive(ss);
+    archive(values...);
+}
+
+inline int mpi_rank() {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    return rank;
+}
+
+inline int mpi_size() {
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    return size;
+}
+
+// the next message from source (any rank by default) with tag (any by
+// default), with its source and tag in status
+inline string mpi_recv_bytes(MPI_Status& status, int source = MPI_ANY_SOURCE, int tag = MPI_ANY_TAG) {
+    MPI_Probe(source, tag, MPI_COMM_WORLD, &status);
+    int n;
+    MPI_Get_count(&status, MPI_BYTE, &n);
+    string bytes(n, '\0');
+    MPI_Recv(&bytes[0], n, MPI_BYTE, status.MPI_SOURCE, status.MPI_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    return bytes;
+}
+
+inline void mpi_send_bytes(const string& bytes, int dest, int tag) {
+    MPI_Send(bytes.data(), bytes.size(), MPI_BYTE, dest, tag, MPI_COMM_WORLD);
+}
+
+// unit messages and results start with the unit's index
+inline string unit_bytes(uint64_t unit) {
+    return string((const char*) &unit, sizeof(unit));
+}
+
+inline uint64_t unit_of(const string& msg) {
+    uint64_t unit;
+    memcpy(&unit, msg.data(), sizeof(unit));
+    return unit;
+}
+
+// rank 0's bytes on every rank
+inline void mpi_broadcast_bytes(string& bytes) {
+    uint64_t n = bytes.size();
+    MPI_Bcast(&n, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+    bytes.resize(n);
+    MPI_Bcast(&bytes[0], n, MPI_BYTE, 0, MPI_COMM_WORLD);
+}
+
+// every rank's bytes, by rank, on rank 0; nothing elsewhere
+inline vector<string> mpi_gather_bytes(const string& bytes) {
+    const int size = mpi_size();
+    const bool root = mpi_rank() == 0;
+    int n = bytes.size();
+    vector<int> counts(root ? size : 0);
+    MPI_Gather(&n, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+    vector<int> displs(counts.size(), 0);
+    for (size_t r = 1; r < counts.size(); r++) displs[r] = displs[r - 1] + counts[r - 1];
+    string all(root ? displs.back() + counts.back() : 0, '\0');
+    MPI_Gatherv(bytes.data(), n, MPI_BYTE, &all[0], counts.data(), displs.data(), MPI_BYTE, 0, MPI_COMM_WORLD);
+    vector<string> parts;
+    for (size_t r = 0; r < counts.size(); r++) parts.push_back(all.substr(displs[r], counts[r]));
+    return parts;
+}
+
+// Run units [0, n_units) across the ranks: work(unit) on the rank it is
+// given to and collect(unit, result) on rank 0 as the results arrive.  With
+// more than one rank, rank 0 only hands out units and collects; alone, it
+// runs them all itself.  Every rank must call this.
+inline void mpi_dispatch(size_t n_units, const function<string(size_t unit)>& work,
+                         const function<void(size_t unit, const string& result)>& collect) {
+    const int size = mpi_size();
+    if (mpi_rank() != 0) {
+        mpi_send_bytes(string(), 0, MPI_TAG_READY);
+        while (true) {
+            MPI_Status status;
+            string msg = mpi_recv_bytes(status, 0);
+            if (status.MPI_TAG == MPI_TAG_DONE) return;
+            const uint64_t unit = unit_of(msg);
+            mpi_send_bytes(unit_bytes(unit) + work(unit), 0, MPI_TAG_RESULT);
+        }
+    }
+    if (size == 1) {
+        for (size_t unit = 0; unit < n_units; unit++) collect(unit, work(unit));
+        return;
+    }
+    size_t next = 0;
+    int working = size - 1;
+    while (working > 0) {
+        // poll rather than block, which busy-waits in some MPI implementations
+        int arrived = 0;
+        MPI_Status status;
+        MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &arrived, &status);
+        if (not arrived) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+            continue;
+        }
+        string msg = mpi_recv_bytes(status, status.MPI_SOURCE, status.MPI_TAG);
+        if (status.MPI_TAG == MPI_TAG_RESULT) collect(unit_of(msg), msg.substr(sizeof(uint64_t)));
+        if (next < n_units) {
+            mpi_send_bytes(unit_bytes(next++), status.MPI_SOURCE, MPI_TAG_UNIT);
+        } else {
+            mpi_send_bytes(string(), status.MPI_SOURCE, MPI_TAG_DONE);
+            working--;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef NDJSON_SERVER_H
+#define NDJSON_SERVER_H
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <string>
+#include <iostream>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace std;
+
+// Worker loop for a long-lived model process: requests arrive one per line
+// (newline-delimited JSON, though nothing here parses them) and handle()
+// turns each into a reply frame, which is written to the output as soon as
+// it is ready.  Up to nthreads requests run at once, so replies come back in
+// the order they finish and should carry something to match them by.
+
+// write all of s to fd
+inline bool write_all(int fd, const string& s) {
+    size_t done = 0;
+    while (done < s.size()) {
+        ssize_t n = write(fd, s.data() + done, s.size() - done);
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+// Serve the requests read from in_fd until it ends, replying on out_fd.
+// handle(line, index) gets each non-empty line and its 0-based index.
+inline void serve_stream(int in_fd, int out_fd, unsigned nthreads,
+                         const function<string(const string&, size_t)>& handle) {
+    if (nthreads == 0) nthreads = max(1u, thread::hardware_concurrency());
+    const size_t max_waiting = 2 * nthreads;    // read ahead no further than this
+    mutex m;
+    condition_variable changed;
+    deque<pair<size_t, string>> waiting;
+    bool ended = false;
+    mutex out_m;
+
+    vector<thread> workers;
+    for (unsigned t = 0; t < nthreads; t++) {
+        workers.push_back(thread([&] {
+            unique_lock<mutex> lock(m);
+            while (true) {
+                changed.wait(lock, [&] { return ended or not waiting.empty(); });
+                if (waiting.empty()) return;
+                pair<size_t, string> request = std::move(waiting.front());
+                waiting.pop_front();
+                changed.notify_all();
+                lock.unlock();
+                const string reply = handle(request.second, request.first);
+                {
+                    lock_guard<mutex> out_lock(out_m);
+                    write_all(out_fd, reply);
+                }
+                lock.lock();
+            }
+        }));
+    }
+
+    FILE* in = fdopen(dup(in_fd), "r");
+    char* buf = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    size_t index = 0;
+    while (in != NULL and (len = getline(&buf, &cap, in)) != -1) {
+        string line(buf, len);
+        while (not line.empty() and (line.back() == '\n' or line.back() == '\r')) line.pop_back();
+        if (line.empty()) continue;
+        unique_lock<mutex> lock(m);
+        changed.wait(lock, [&] { return waiting.size() < max_waiting; });
+        waiting.push_back(make_pair(index++, std::move(line)));
+        changed.notify_all();
+    }
+    free(buf);
+    if (in != NULL) fclose(in);
+    {
+        lock_guard<mutex> lock(m);
+        ended = true;
+    }
+    changed.notify_all();
+    for (auto& w : workers) w.join();
+}
+
+// Listen on a Unix socket at path and serve each connection in turn with
+// serve_stream(), replies going back over the same connection.  Returns
+// only if the socket cannot be set up.
+inline int serve_unix_socket(const string& path, unsigned nthreads,
+                             const function<string(const string&, size_t)>& handle) {
+    struct sockaddr_un addr;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        cerr << "ERROR: Socket path too long: " << path << endl;
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN);       // a client going away is only a failed write
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        cerr << "ERROR: Could not create socket: " << strerror(errno) << endl;
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+    unlink(path.c_str());
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 or listen(fd, 8) != 0) {
+        cerr << "ERROR: Could not listen on " << path << ": " << strerror(errno) << endl;
+        close(fd);
+        return -1;
+    }
+    while (true) {
+        int conn = accept(fd, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR) continue;
+            cerr << "ERROR: accept failed: " << strerror(errno) << endl;
+            close(fd);
+            return -1;
+        }
+        serve_stream(conn, conn, nthreads, handle);
+        close(conn);
+    }
+}
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef NUCOVID_API_H
+#define NUCOVID_API_H
+
+/* C interface to the simulator, built as libnucovid.so (make lib in
+ * exp/chicago_yr1), for calling it in-process from R, Python and the like.
+ *
+ * Parameters are the JSON object the model binary takes on its command
+ * line, over the same defaults.  A simulation records the daily output
+ * rows of every run as numbers; they can be fetched one column at a time,
+ * in the order of the model's daily_output.txt:
+ *
+ *     node, time, Ki, S, E, AP, SYM, HOS, CRIT, DEA, R, cumu_sym, cumu_adm, introduced
+ *
+ * Functions returning int give 0 on success and -1 on failure, functions
+ * returning a pointer give NULL on failure; nucovid_last_error() then says
+ * why.  A simulation must not be used from two threads at once, but
+ * separate simulations can run in parallel.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NUCOVID_API_VERSION 1
+#define NUCOVID_COLUMNS 14
+
+typedef struct nucovid_sim nucovid_sim;
+
+/* name of column 0 <= column < NUCOVID_COLUMNS, or NULL */
+const char* nucovid_column_name(int column);
+
+/* A new simulation seeded at day 9, as the model binary does, or continuing
+ * the checkpoint params["restore_from"] if that is given. */
+nucovid_sim* nucovid_create(const char* params_json);
+
+/* A simulation continuing from the checkpoint fname (flat or cereal), with
+ * the parameters in params_json applied as the model binary's restore_from
+ * does: it keeps the checkpoint's generator and random state unless
+ * params_json gives rng, or random_seeds with a time 0 seed other than -1. */
+nucovid_sim* nucovid_restore(const char* fname, const char* params_json);
+
+/* Days a run would last in the model binary: params["duration"] less the
+ * 9 days before seeding for a new simulation, params["duration"] after a
+ * restore.  Meant for the first nucovid_run() call.  NAN on failure. */
+double nucovid_duration(const nucovid_sim* sim);
+
+/* Simulate duration more days with the engine in params["engine"] (exact,
+ * hybrid or next_reaction).  Rows are added to the daily output; a day
+ * already recorded by the previous run is not repeated. */
+int nucovid_run(nucovid_sim* sim, double duration);
+
+/* rows of daily output recorded so far */
+size_t nucovid_rows(const nucovid_sim* sim);
+
+/* copy column 0 <= column < NUCOVID_COLUMNS of the daily output to
+ * out[0 .. nucovid_rows(sim) - 1] */
+int nucovid_column(const nucovid_sim* sim, int column, double* out);
+
+/* save the current state, in the format of params["checkpoint_format"] */
+int nucovid_checkpoint(nucovid_sim* sim, const char* fname);
+
+void nucovid_destroy(nucovid_sim* sim);
+
+/* what the last failed call on this thread went wrong with */
+const char* nucovid_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -8,7 +8,14 @@
 #include <iomanip>
 #include <queue>
 #include <sstream>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <set>
 #include "Utility.h"
+#include "Event_Queue.h"
+#include "Counter_RNG.h"
+#include "Stream_Writer.h"
 #include <climits>
 #include "sys/stat.h"
 #include <cereal/archives/binary.hpp>
@@ -18,7 +25,7 @@
 
 using namespace std;
 
-double inv_adj_inv (double a, double b) { return 1/(1/a - b); }
+inline double inv_adj_inv (double a, double b) { return 1/(1/a - b); }
 
 typedef enum {
     SUSCEPTIBLE, 
@@ -36,9 +43,67 @@ typedef enum {
 } stateType;
 
 typedef enum {
-    PRE, ASY, SYMM, SYMS, HOS, CRI, HPC, DEA, RECA, RECM, RECH, RECC, CON, IMM
+    PRE, ASY, SYMM, SYMS, HOS, CRI, HPC, DEA, RECA, RECM, RECH, RECC, CON, IMM,
+    PRS     // change of infectiousness class, with aggregate_contacts
 } eventType;
 
+// Infectiousness classes that make up a node's infection pressure when
+// contacts are aggregated (see NUCOVID_next_reaction.h): multiplier
+// frac_infectiousness_As, frac_infectiousness_det or 1.
+typedef enum {
+    PC_AS, PC_DET, PC_UNDET,
+    PC_NONE     // not infectious
+} pressureClass;
+
+// Everything infect() needs from a node for one simulated day, with the
+// derived rates already computed.  112 bytes; the rows are not cache line
+// aligned (std::allocator ignores alignas(64) before C++17), so a lookup
+// touches two or three cache lines.
+struct DayParams {
+    double Ki;
+    double Pdet[4];             // A, P, Sm, Ss
+    double Pcrit;
+    double Pdeath;
+    double Krec[5];             // A, Sm, H, C, HPC
+    double Krec_asym_adj;       // inv_adj_inv(Krec[0], time_to_detect[0])
+    double Krec_mild_adj;       // inv_adj_inv(Krec[1], time_to_detect[1])
+};
+
+// One node's row of the daily output, as numbers; print_state() formats it.
+enum { DS_S, DS_E, DS_AP, DS_SYM, DS_HOS, DS_CRIT, DS_DEA, DS_R, DS_CUMU_SYM, DS_CUMU_ADM, DS_INTRO,
+       DS_COUNTS // DS_COUNTS must be last
+};
+struct DailyState {
+    int node;
+    int day;
+    double Ki;
+    int64_t counts[DS_COUNTS];
+
+    template<class Archive>
+    void serialize(Archive & archive) {
+        archive( node, day, Ki, counts );
+    }
+};
+const int DAILY_COLUMNS = DS_COUNTS + 3;    // node, day and Ki first
+const char* const DAILY_COLUMN_NAMES[DAILY_COLUMNS] = {
+    "node", "time", "Ki", "S", "E", "AP", "SYM", "HOS", "CRIT", "DEA", "R", "cumu_sym", "cumu_adm", "introduced"
+};
+
+// header line of the text output
+inline string daily_header() {
+    string header = DAILY_COLUMN_NAMES[0];
+    for (int c = 1; c < DAILY_COLUMNS; c++) header += string("\t") + DAILY_COLUMN_NAMES[c];
+    return header;
+}
+
+// a row of the text output
+inline string daily_line(const DailyState& ds) {
+    stringstream ss;
+    ss << setprecision(5) << ds.node << "\t" << ds.day << "\t" << ds.Ki;
+    for (int c = 0; c < DS_COUNTS; c++) ss << "\t" << ds.counts[c];
+    return ss.str();
+}
+
 class Node {
     public:
         int id;
@@ -51,10 +116,12 @@ class Node {
         double Khosp;               // param for exponential time to hospitalized from severe 
         double Kcrit;               // param for exponential time to critical from hospitalized 
         double Kdeath;              // param for exponential time to death from critical
-        vector<vector<double>> Krec;// param for exponential time to recovery (A, Sm, H, C, HPC)
+        // the per-day tables of rows below are read-only once set, and shared
+        // by copies of the node (see Event_Driven_NUCOVID::fork())
+        shared_ptr<const vector<vector<double>>> Krec;  // param for exponential time to recovery (A, Sm, H, C, HPC)
         vector<double> Pcrit;       // probability of critical given hospitalized
         vector<double> Pdeath;      // probability of death given critical
-        vector<vector<double>> Pdetect; // probability of detection (A, P, Sm, Ss)
+        shared_ptr<const vector<vector<double>>> Pdetect;   // probability of detection (A, P, Sm, Ss)
         double frac_infectiousness_As;  // infectiousness multiplier for As
         double frac_infectiousness_det; // infectiousness multiplier for detected
         vector<int> state_counts;   // S, E, I, R counts
@@ -63,6 +130,16 @@ class Node {
         size_t cumu_admission;
         size_t introduced;
 
+        // derived from the parameters above by build_day_params(), not serialized;
+        // copies of the node (see Event_Driven_NUCOVID::fork()) share the table
+        // until one of them builds its own
+        shared_ptr<const vector<DayParams>> day_params;    // one row per day; the last row is used past the end
+        double Kdetect[3];              // 1/time_to_detect
+        double Khosp_adj;               // inv_adj_inv(Khosp, time_to_detect[2])
+        // latest day looked up with on_day() since reset(): the state depends
+        // on the per-day parameters up to here and no further
+        mutable int last_day_read;
+
         // constructor
         Node( int ii, int n, vector<double> ki, double ka, double kp, double km, double ks, 
               double kh, double kc, double kd, vector<vector<double>> kr,
@@ -79,10 +156,10 @@ class Node {
             Khosp = kh;
             Kcrit = kc;
             Kdeath = kd;
-            Krec = kr;
+            Krec = make_shared<const vector<vector<double>>>(std::move(kr));
             Pcrit = pc;
             Pdeath = pd;
-            Pdetect = pdets;
+            Pdetect = make_shared<const vector<vector<double>>>(std::move(pdets));
             cumu_symptomatic = 0;
             cumu_admission = 0;
             introduced = 0;
@@ -90,56 +167,157 @@ class Node {
             frac_infectiousness_As = fia;
             frac_infectiousness_det = fid;
             time_to_detect = t2det;
+            last_day_read = 0;
+            build_day_params();
+        }
+
+        Node() : last_day_read(0) {};
+
+        // Must be called whenever Ki, Krec, Pcrit, Pdeath, Pdetect, Khosp or
+        // time_to_detect change.  The table covers at least horizon days.
+        void build_day_params(size_t horizon = 0) {
+            size_t ndays = max({ horizon, Ki.size(), Krec->size(), Pcrit.size(), Pdeath.size(), Pdetect->size() });
+            shared_ptr<vector<DayParams>> table = make_shared<vector<DayParams>>(ndays);
+            for (size_t day = 0; day < ndays; day++) (*table)[day] = day_row(day);
+            day_params = table;
+            for (int i = 0; i < 3; i++) Kdetect[i] = 1/time_to_detect[i];
+            Khosp_adj = inv_adj_inv(Khosp, time_to_detect[2]);
         }
 
-        Node() {};
+        DayParams day_row(size_t day) const {
+            DayParams p;
+            p.Ki = get_Ki(day);
+            for (int i = 0; i < 4; i++) p.Pdet[i] = get_Pdet(day, i);
+            p.Pcrit = get_Pcrit(day);
+            p.Pdeath = get_Pdeath(day);
+            for (int i = 0; i < 5; i++) p.Krec[i] = get_Krec(day, i);
+            p.Krec_asym_adj = inv_adj_inv(p.Krec[0], time_to_detect[0]);
+            p.Krec_mild_adj = inv_adj_inv(p.Krec[1], time_to_detect[1]);
+            return p;
+        }
+
+        const DayParams& on_day(int day) const {
+            if (day > last_day_read) last_day_read = day;
+            const vector<DayParams>& table = *day_params;
+            return table[(size_t) day < table.size() ? day : table.size() - 1];
+        }
+
+        size_t days() const { return day_params ? day_params->size() : 0; }
 
         void reset() {
             state_counts.clear();
             state_counts.resize(STATE_SIZE, 0);
             state_counts[SUSCEPTIBLE] = N;
+            cumu_symptomatic = 0;
+            cumu_admission = 0;
+            introduced = 0;
+            last_day_read = 0;
         }
 
-        double get_Ki(int day) { return day < Ki.size() ? Ki[day] : Ki[Ki.size() - 1]; }
-        double get_Pdet(int day, int ind) { return day < Pdetect.size() ? Pdetect[day][ind] : Pdetect[Pdetect.size() - 1][ind]; }
-        double get_Pcrit(int day) { return day < Pcrit.size() ? Pcrit[day] : Pcrit[Pcrit.size() - 1]; }
-        double get_Pdeath(int day) { return day < Pdeath.size() ? Pdeath[day] : Pdeath[Pdeath.size() - 1]; }
-        double get_Krec(int day, int ind) { return day < Krec.size() ? Krec[day][ind] : Krec[Krec.size() - 1][ind]; }
+        // lookups into the raw parameter vectors; the simulator uses on_day()
+        double get_Ki(size_t day) const { return day < Ki.size() ? Ki[day] : Ki[Ki.size() - 1]; }
+        double get_Pdet(size_t day, int ind) const { return (*Pdetect)[day < Pdetect->size() ? day : Pdetect->size() - 1][ind]; }
+        double get_Pcrit(size_t day) const { return day < Pcrit.size() ? Pcrit[day] : Pcrit[Pcrit.size() - 1]; }
+        double get_Pdeath(size_t day) const { return day < Pdeath.size() ? Pdeath[day] : Pdeath[Pdeath.size() - 1]; }
+        double get_Krec(size_t day, int ind) const { return (*Krec)[day < Krec->size() ? day : Krec->size() - 1][ind]; }
 
+        // the shared tables are archived by value
         template<class Archive>
         void serialize(Archive & archive) {
-            archive( id, N, Ki, Kasym, Kpres, Kmild, Ksevere, Khosp, Kcrit, Kdeath, Krec,
-                     Pcrit, Pdeath, Pdetect, frac_infectiousness_As, frac_infectiousness_det,
+            vector<vector<double>> krec, pdetect;
+            if (not Archive::is_loading::value) {
+                krec = *Krec;
+                pdetect = *Pdetect;
+            }
+            archive( id, N, Ki, Kasym, Kpres, Kmild, Ksevere, Khosp, Kcrit, Kdeath, krec,
+                     Pcrit, Pdeath, pdetect, frac_infectiousness_As, frac_infectiousness_det,
                      state_counts, time_to_detect, cumu_symptomatic, cumu_admission, introduced );
+            if (Archive::is_loading::value) {
+                Krec = make_shared<const vector<vector<double>>>(std::move(krec));
+                Pdetect = make_shared<const vector<vector<double>>>(std::move(pdetect));
+                build_day_params();
+            }
         }
 };
 
+// Events refer to nodes by their index in Event_Driven_NUCOVID::nodes and are
+// packed into 16 bytes so the heap stays dense and copies are trivial.
 class Event {
     public:
         double time;
-        eventType type;
-        shared_ptr<Node> source_node;
-        shared_ptr<Node> target_node;
-        bool detect;
+        uint32_t type : 8;          // eventType
+        uint32_t detect : 1;
+        uint32_t contact : 23;      // ContactProcess id + 1 that drew this CON event (0 if pre-scheduled)
+        uint16_t source;            // source node index
+        uint16_t target;            // target node index
+
+        static const int MAX_CONTACT_ID = (1 << 23) - 2;
+        static const int MAX_NODES = 1 << 16;
+
         Event() {};
-        Event(const Event& o) {  time=o.time; type=o.type; source_node=o.source_node; target_node=o.target_node; detect=o.detect;}
-        Event(double t, eventType e, shared_ptr<Node> sn, shared_ptr<Node> tn, bool det) {time=t; type=e; source_node=sn; target_node=tn; detect=det;}
-        Event& operator=(const Event& o) { time=o.time; type=o.type; source_node=o.source_node; target_node=o.target_node; detect=o.detect; return *this; }
+        Event(double t, eventType e, int sn, int tn, bool det, int cid = -1) : 
+            time(t), type(e), detect(det), contact(cid + 1), source(sn), target(tn) {}
+
+        int contact_id() const { return (int) contact - 1; }
+
+        uint64_t tiebreak() const {
+            return ((uint64_t) type << 56) | ((uint64_t) detect << 55) | ((uint64_t) contact << 32) |
+                   ((uint64_t) source << 16) | (uint64_t) target;
+        }
 
         template<class Archive>
-        void serialize(Archive & archive) {
-            archive( time, type, source_node, target_node, detect );
+        void save(Archive & archive) const {
+            uint8_t t = type;
+            bool d = detect;
+            int cid = contact_id();
+            archive( time, t, source, target, d, cid );
+        }
+
+        template<class Archive>
+        void load(Archive & archive) {
+            uint8_t t;
+            bool d;
+            int cid;
+            archive( time, t, source, target, d, cid );
+            type = t;
+            detect = d;
+            contact = cid + 1;
         }
 };
 
+static_assert(sizeof(Event) == 16, "Event should pack into 16 bytes");
+
 class compTime {
     public:
         bool operator() (const Event* lhs, const Event* rhs) const {
-            return (lhs->time>rhs->time);
+            return (*this)(*lhs, *rhs);
         }
 
+        // ties in time are broken on the remaining fields so the order is
+        // total and does not depend on the queue backend
         bool operator() (const Event& lhs, const Event& rhs) const {
-            return (lhs.time>rhs.time);
+            if (lhs.time != rhs.time) return (lhs.time>rhs.time);
+            return (lhs.tiebreak()>rhs.tiebreak());
+        }
+};
+
+typedef EventScheduler<Event, compTime> EventQueue;
+
+// Remaining contact schedule of one infectious individual.  With lazy
+// contacts only the next CON event is queued; the following one is drawn
+// from this state when that event fires.
+class ContactProcess {
+    public:
+        int node;                   // index of the infectious individual's node
+        double Tr;                  // time of recovery/death, no contacts after this
+        bool detect;
+        size_t bin;                 // current index into Times/Ki_modifier
+        vector<double> Times;       // start times of the infectiousness bins
+        vector<double> Ki_modifier; // infectiousness multiplier for each bin
+
+        template<class Archive>
+        void serialize(Archive & archive) {
+            archive( node, Tr, detect, bin, Times, Ki_modifier );
         }
 };
 
@@ -205,50 +383,98 @@ public:
     }
 };
 
+// Layout of the cereal archive of Event_Driven_NUCOVID.  Archives written
+// before it was versioned start with the number of nodes, which reads as
+// version 1 for the one-node model, so versions start at 2.
+const uint32_t CEREAL_ARCHIVE_VERSION = 2;
+
 class Event_Driven_NUCOVID {
     public:
         vector<shared_ptr<Node>> nodes;
         vector<vector<double>> infection_matrix;
-        priority_queue<Event, vector<Event>, compTime > EventQ; // event queue
+        vector<AliasTable> infection_tables;    // O(1) sampling of infection_matrix rows
+        EventQueue EventQ;          // event queue
+        vector<Event> pending_events;       // events drawn while handling the current one
         double Now; // Current "time" in simulation
         double offset;                
         mt19937 rng;              // RNG
+        bool counter_rng;           // use per-event Philox streams instead of rng
+        uint64_t rng_key;           // Philox key (the current seed)
+        uint64_t rng_counter;       // Philox stream id, one per CON event / seed infection
+        bool lazy_contacts;         // draw contacts one at a time instead of all at infection
+        vector<ContactProcess> contacts;    // active contact processes (lazy or aggregate mode)
+        vector<int> free_contacts;          // reusable slots in contacts
+        vector<int>* divert_infections;     // if set, CON infections are only counted here, per node,
+                                            // and left to the tau-leaping engine (see NUCOVID_tau_leap.h)
+        bool aggregate_contacts;    // queue PRS events instead of contacts, for NUCOVID_next_reaction.h
+        vector<DailyState>* record_daily;   // if set, print_state() also appends its rows here
+        bool format_text;                   // if not, print_state() leaves the text output empty
+        StreamWriter* stream_to;            // if set, print_state() writes its lines here instead of returning them
+        // if set, print_state() passes it each day's rows, and the run ends
+        // after the first day it returns false for, with stopped set
+        function<bool(int day, const vector<DailyState>& rows)> day_check;
+        bool stopped;
+        // run_simulation() passes snapshot a fork() of the state as it would be
+        // at the end of a run to each of these days, e.g. to checkpoint it
+        set<int> snapshot_days;
+        function<void(int day, Event_Driven_NUCOVID& state)> snapshot;
         
-        Event_Driven_NUCOVID () {};
-        Event_Driven_NUCOVID (vector<shared_ptr<Node>> ns, vector<vector<double>> mat) {
+        Event_Driven_NUCOVID () : counter_rng(false), rng_key(0), rng_counter(0), lazy_contacts(false),
+                                  divert_infections(NULL), aggregate_contacts(false), record_daily(NULL),
+                                  format_text(true), stream_to(NULL), stopped(false) {};
+        Event_Driven_NUCOVID (vector<shared_ptr<Node>> ns, vector<vector<double>> mat) :
+            counter_rng(false), rng_key(0), rng_counter(0), lazy_contacts(false), divert_infections(NULL),
+            aggregate_contacts(false), record_daily(NULL), format_text(true), stream_to(NULL), stopped(false) {
             nodes = ns;
             infection_matrix = mat;
             
             // integrity check nodes vs infection_matrix
             assert(mat.size() == ns.size());
+            assert(ns.size() <= Event::MAX_NODES);
             for (size_t i = 0; i < mat.size(); i++) {
                 assert(mat[i].size() == ns.size());
             }
+            build_infection_tables();
             reset();
         }
 
+        DailyState daily_state(size_t i, int day) const {
+            const Node* n = nodes[i].get();
+            DailyState ds;
+            ds.node = n->id;
+            ds.day = day;
+            ds.Ki = n->Ki[day];
+            ds.counts[DS_S] = n->state_counts[SUSCEPTIBLE];
+            ds.counts[DS_E] = n->state_counts[EXPOSED];
+            ds.counts[DS_AP] = n->state_counts[ASYMPTOMATIC] + n->state_counts[PRESYMPTOMATIC];
+            ds.counts[DS_SYM] = n->state_counts[SYMPTOMATIC_MILD] + n->state_counts[SYMPTOMATIC_SEVERE];
+            ds.counts[DS_HOS] = n->state_counts[HOSPITALIZED] + n->state_counts[HOSPITALIZED_CRIT];
+            ds.counts[DS_CRIT] = n->state_counts[CRITICAL];
+            ds.counts[DS_DEA] = n->state_counts[DEATH];
+            ds.counts[DS_R] = n->state_counts[RESISTANT];
+            ds.counts[DS_CUMU_SYM] = n->cumu_symptomatic;
+            ds.counts[DS_CUMU_ADM] = n->cumu_admission;
+            ds.counts[DS_INTRO] = n->introduced;
+            return ds;
+        }
+
         void print_state (vector<string>* out_buffer, int day, bool print) {
+            vector<DailyState> rows;
             for (size_t i = 0; i < nodes.size(); i++) {
-                const shared_ptr<Node> n = nodes[i];
-                stringstream ss;
-                ss << setprecision(5) << n->id << "\t"   
-                                      << day << "\t"  << n->Ki[day] << "\t" 
-                                      << n->state_counts[SUSCEPTIBLE] << "\t" 
-                                      << n->state_counts[EXPOSED] << "\t" 
-                                      << n->state_counts[ASYMPTOMATIC] + n->state_counts[PRESYMPTOMATIC]<< "\t" 
-                                      << n->state_counts[SYMPTOMATIC_MILD] + n->state_counts[SYMPTOMATIC_SEVERE] << "\t"
-                                      << n->state_counts[HOSPITALIZED] + n->state_counts[HOSPITALIZED_CRIT]<< "\t"
-                                      << n->state_counts[CRITICAL] << "\t"
-                                      << n->state_counts[DEATH] << "\t"
-                                      << n->state_counts[RESISTANT] << "\t"
-                                      << n->cumu_symptomatic << "\t"
-                                      << n->cumu_admission << "\t"
-                                      << n->introduced;
-
-                out_buffer->push_back(ss.str());
-                if (print) {cout << ss.str() << endl;}
+                const DailyState ds = daily_state(i, day);
+                if (record_daily) record_daily->push_back(ds);
+                if (day_check) rows.push_back(ds);
+                if (not format_text and not print) continue;
+                const string line = daily_line(ds);
+
+                if (stream_to and format_text) {
+                    stream_to->write(line);
+                } else if (format_text) {
+                    out_buffer->push_back(line);
+                }
+                if (print) {cout << line << endl;}
             }
-
+            if (day_check and not day_check(day, rows)) stopped = true;
         }
 
         double check_next_event_time() {
@@ -260,11 +486,12 @@ class Event_Driven_NUCOVID {
             double start_time = Now;
             double intpart;
             int day;
+            stopped = false;
 
-            vector<string>* out_buffer = new vector<string>;
+            vector<string> out_buffer;
             string header = "node\ttime\tKi\tS\tE\tAP\tSYM\tHOS\tCRIT\tDEA\tR\tcumu_sym\tcumu_adm\tintroduced";
             cout << setprecision(3) << fixed;
-            out_buffer->push_back(header);
+            out_buffer.push_back(header);
             if (print) {cout << header << endl;}
 
             if ( modf(start_time, &intpart) == 0 ) {
@@ -273,23 +500,43 @@ class Event_Driven_NUCOVID {
                 day = ceil(start_time);
             }
 
+            // per-day parameter rows cover the whole run
+            size_t horizon = ceil(start_time + duration + offset) + 1;
+            for (size_t i = 0; i < nodes.size(); i++) {
+                if (nodes[i]->days() < horizon) nodes[i]->build_day_params(horizon);
+            }
+
             std::cout << "start_time, duration, offset: " << start_time << ", " << duration << ", " << offset << std::endl;
             double next_event_time = check_next_event_time();
             // std::cout << "start_time, duration: " << start_time << ", " << duration << std::endl;
             // std::cout << "1 Next Evt Time: " << next_event_time << std::endl;
+            size_t n_events = 0;
+            auto next_snapshot = snapshot_days.upper_bound((int) floor(start_time + offset));  // where the last run ended
+            auto wall_start = std::chrono::steady_clock::now();
             while ( (next_event_time != -1) and (next_event_time < start_time + duration + offset) ) {
+                // the state a run ending here would have left, before the day's reseed
+                while (next_snapshot != snapshot_days.end() and next_event_time >= *next_snapshot) {
+                    if (snapshot) {
+                        Event_Driven_NUCOVID state = fork();
+                        state.offset = *next_snapshot - Now;
+                        snapshot(*next_snapshot, state);
+                    }
+                    next_snapshot++;
+                }
                 if (next_event_time > day) {
                     auto iter = seeds.find(static_cast<double>(day));
                     if (iter != seeds.end()) {
                         int seed = iter->second;
                         // std::cout << "Updating seed at day " << day << " to " << seed << std::endl;
-                        rng.seed(seed);
+                        reseed(seed);
                     }
-                    print_state(out_buffer, day, print);
+                    print_state(&out_buffer, day, print);
                     day++;
+                    if (stopped) break;
                 }
 
                 next_event();
+                n_events++;
                 next_event_time = check_next_event_time();
                 // std::cout << "Next Evt Time: " << next_event_time << std::endl;
                 continue;
@@ -298,14 +545,17 @@ class Event_Driven_NUCOVID {
             // offset = duration - Now
             offset = (start_time + duration + offset) - Now;
             std::cout << "duration, now, offset: " << duration << ", " << Now << ", " << offset << std::endl;
+            double wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+            std::cout << "events, wall time, events/sec: " << n_events << ", " << wall_time << ", "
+                      << (wall_time > 0 ? n_events / wall_time : 0) << std::endl;
 
             // non-continued sims are set to start at 9, so we need
             // to account for that.
             // if (start_time == 9.0) offset += 9.0;
             // std::cout << duration << " " << Now << std::endl;
-            print_state(out_buffer, day, print);
+            if (not stopped) print_state(&out_buffer, day, print);
 
-            return (*out_buffer);
+            return out_buffer;
         }
 
         //Epidemic size not used for now
@@ -321,39 +571,75 @@ class Event_Driven_NUCOVID {
             for (size_t i = 0; i < nodes.size(); i++) {
                 nodes[i]->reset();
             }
-            EventQ = priority_queue<Event, vector<Event>, compTime > ();
+            EventQ.clear();
+            pending_events.clear();
+            contacts.clear();
+            free_contacts.clear();
+        }
+
+        // Independent copy of the complete state (nodes, queue, RNG, offset)
+        // to continue a run from here down another branch.  The nodes are
+        // copied, but their Krec and Pdetect tables are shared, and so are
+        // their day tables until either side rebuilds one, so a fork costs
+        // about as much as copying the queue.
+        Event_Driven_NUCOVID fork() {
+            flush_events();
+            Event_Driven_NUCOVID copy(*this);
+            for (size_t i = 0; i < copy.nodes.size(); i++) copy.nodes[i] = make_shared<Node>(*nodes[i]);
+            copy.divert_infections = NULL;
+            copy.record_daily = NULL;
+            copy.stream_to = NULL;
+            copy.day_check = nullptr;
+            return copy;
+        }
+
+        // With counter_rng, reseeding only changes the Philox key; rng_counter
+        // keeps running so streams drawn before and after stay distinct.
+        void reseed(int seed) {
+            if (counter_rng) {
+                rng_key = (uint32_t) seed;
+            } else {
+                rng.seed(seed);
+            }
         }
 
         void rand_infect(int k, shared_ptr<Node> n) {   // randomly infect k people
             for (unsigned int i = 0; i < k; i++) {
-                CachedBitGenerator cbg(rng, 100);
-                infect(n, cbg);
+                if (counter_rng) {
+                    Philox4x32 gen(rng_key, rng_counter++);
+                    infect(n.get(), gen);
+                } else {
+                    CachedBitGenerator cbg(rng, 100);
+                    infect(n.get(), cbg);
+                }
                 //import_As(n);
             }
+            flush_events();
         }
         
         double get_detection_modifier(double p, double r) {return p * r + (1.0 - p);}
 
         template<typename RNG_T>
         size_t get_infection_node_id(size_t nid, RNG_T& cbg) {
-            double total_weight = 0.0;
-            size_t chosen;
-            for (size_t i = 0; i < infection_matrix.size(); i++) { total_weight += infection_matrix[nid][i]; }
-            double r = rand_uniform(0, total_weight, &cbg);
-            for (size_t i = 0; i < infection_matrix.size(); i++) { 
-                if (r < infection_matrix[nid][i]) {
-                    chosen = i;
-                    break;
-                } else {
-                    r -= infection_matrix[nid][i]; 
-                }
+            return infection_tables[nid].sample(&cbg);
+        }
+
+        // one alias table per row of infection_matrix; must be rebuilt whenever the matrix changes
+        void build_infection_tables() {
+            infection_tables.resize(infection_matrix.size());
+            for (size_t i = 0; i < infection_matrix.size(); i++) {
+                infection_tables[i].build(infection_matrix[i]);
             }
+        }
 
-            return chosen;
+        void set_infection_matrix(const vector<vector<double>>& mat) {
+            assert(mat.size() == nodes.size());
+            infection_matrix = mat;
+            build_infection_tables();
         }
 
         template<typename RNG_T>
-        void import_As(shared_ptr<Node> n, RNG_T& cbg) {
+        void import_As(Node* n, RNG_T& cbg) {
             n->state_counts[SUSCEPTIBLE]--;  // decrement susceptible groupjj
             n->state_counts[ASYMPTOMATIC]++;      // increment exposed group
 
@@ -367,29 +653,29 @@ class Event_Driven_NUCOVID {
             // time to become infectious
             Ti = Now;
             if (not det_flag) {
-                det_flag = rand_uniform(0, 1, &cbg) < n->get_Pdet((int) Ti, 0) ? true : false;
+                det_flag = rand_uniform(0, 1, &cbg) < n->on_day((int) Ti).Pdet[0] ? true : false;
             }
             Times.push_back(Ti);
             Ki_modifier.push_back(det_flag ? n->frac_infectiousness_det * n->frac_infectiousness_As : n->frac_infectiousness_As);
  
             // time to recovery
-            Tr = rand_exp(n->get_Krec((int) Ti, 0), &cbg) + Ti;
-            add_event(Tr, RECA, n, n, det_flag);
+            Tr = rand_exp(n->on_day((int) Ti).Krec[0], &cbg) + Ti;
+            add_event(Tr, RECA, n->id, n->id, det_flag);
 
             // time to next contact
             int bin = 0;
-            double Tc = rand_exp(n->get_Ki((int) Ti) * Ki_modifier[bin], &cbg) + Ti;
+            double Tc = rand_exp(n->on_day((int) Ti).Ki * Ki_modifier[bin], &cbg) + Ti;
             while ( Tc < Tr ) {     // does contact occur before recovery?
                 // decide which node to infect
                 size_t infect_node_id = get_infection_node_id(n->id, cbg);
-                add_event(Tc, CON, n, nodes[infect_node_id], det_flag); // potential transmission event
+                add_event(Tc, CON, n->id, infect_node_id, det_flag); // potential transmission event
                 while (bin < Times.size() - 1 and Times[bin+1] < Tc) {bin++;} // update bin if necessary
-                Tc += rand_exp(n->get_Ki((int) Tc) * Ki_modifier[bin], &cbg);
+                Tc += rand_exp(n->on_day((int) Tc).Ki * Ki_modifier[bin], &cbg);
             }
         }
 
         template<typename RNG_T>
-        void infect(shared_ptr<Node> n, RNG_T& cbg) {
+        void infect(Node* n, RNG_T& cbg) {
             assert(n->state_counts[SUSCEPTIBLE] > 0);
             n->state_counts[SUSCEPTIBLE]--;  // decrement susceptible groupjj
             n->state_counts[EXPOSED]++;      // increment exposed group
@@ -415,8 +701,8 @@ class Event_Driven_NUCOVID {
                 
                 // Pre-symptomatic phase (no pre-detection here)
                 Ti = Tpres;
-                if (not det_flag) det_flag = rand_uniform(0, 1, &cbg) < n->get_Pdet((int) Ti, 1);
-                add_event(Tpres, PRE, n, n, det_flag);
+                if (not det_flag) det_flag = rand_uniform(0, 1, &cbg) < n->on_day((int) Ti).Pdet[1];
+                add_event(Tpres, PRE, n->id, n->id, det_flag);
                 Times.push_back(Ti);
                 Ki_modifier.push_back(det_flag ? n->frac_infectiousness_det : 1);
 
@@ -427,57 +713,57 @@ class Event_Driven_NUCOVID {
                     // Mild SYMPTOMATIC PATH
                     // pre-detection phase
                     Tsym = Tmild;
-                    add_event(Tsym, SYMM, n, n, det_flag);
+                    add_event(Tsym, SYMM, n->id, n->id, det_flag);
                     Times.push_back(Tsym);
                     Ki_modifier.push_back(det_flag ? n->frac_infectiousness_det : 1);
 
                     // detection phase
-                    double Tdet = rand_exp(1/n->time_to_detect[1], &cbg) + Tsym;
-                    if (not det_flag) det_flag = rand_uniform(0, 1, &cbg) < n->get_Pdet((int) Tsym, 2);
+                    double Tdet = rand_exp(n->Kdetect[1], &cbg) + Tsym;
+                    if (not det_flag) det_flag = rand_uniform(0, 1, &cbg) < n->on_day((int) Tsym).Pdet[2];
                     Times.push_back(Tdet);
                     Ki_modifier.push_back(det_flag ? n->frac_infectiousness_det : 1);
 
-                    Tr = rand_exp(inv_adj_inv(n->get_Krec((int) Ti, 1), n->time_to_detect[1]), &cbg) + Tdet;
-                    add_event(Tr, RECM, n, n, det_flag);
+                    Tr = rand_exp(n->on_day((int) Ti).Krec_mild_adj, &cbg) + Tdet;
+                    add_event(Tr, RECM, n->id, n->id, det_flag);
                 } else {
                     // Severe SYMPTOMATIC PATH
                     // pre-detection phase
                     Tsym = Tsevere;
-                    add_event(Tsym, SYMS, n, n, det_flag);
+                    add_event(Tsym, SYMS, n->id, n->id, det_flag);
                     Times.push_back(Tsym);
                     Ki_modifier.push_back(det_flag ? n->frac_infectiousness_det : 1);
 
                     // detection phase
-                    double Tdet = rand_exp(1/n->time_to_detect[2], &cbg) + Tsym;
-                    if (not det_flag) det_flag = rand_uniform(0, 1, &cbg) < n->get_Pdet((int) Tsym, 3);
+                    double Tdet = rand_exp(n->Kdetect[2], &cbg) + Tsym;
+                    if (not det_flag) det_flag = rand_uniform(0, 1, &cbg) < n->on_day((int) Tsym).Pdet[3];
                     Times.push_back(Tdet);
                     Ki_modifier.push_back(det_flag ? n->frac_infectiousness_det : 1);
 
-                    Th = rand_exp(inv_adj_inv(n->Khosp, n->time_to_detect[2]), &cbg) + Tdet;
-                    add_event(Th, HOS, n, n, det_flag);
+                    Th = rand_exp(n->Khosp_adj, &cbg) + Tdet;
+                    add_event(Th, HOS, n->id, n->id, det_flag);
                     Times.push_back(Th);
                     Ki_modifier.push_back(det_flag ? n->frac_infectiousness_det : 1);
 
-                    if (rand_uniform(0, 1, &cbg) > n->get_Pcrit((int) Th)) {
+                    if (rand_uniform(0, 1, &cbg) > n->on_day((int) Th).Pcrit) {
                         // Hospitalized and recovered
-                        Tr = rand_exp(n->get_Krec((int) Th, 2), &cbg) + Th;
-                        add_event(Tr, RECH, n, n, det_flag);
+                        Tr = rand_exp(n->on_day((int) Th).Krec[2], &cbg) + Th;
+                        add_event(Tr, RECH, n->id, n->id, det_flag);
                     } else {
                         // Hospitalized and become critical
                         Tcr = rand_exp(n->Kcrit, &cbg) + Th;
-                        add_event(Tcr, CRI, n, n, det_flag);
+                        add_event(Tcr, CRI, n->id, n->id, det_flag);
 
-                        if (rand_uniform(0, 1, &cbg) > n->get_Pdeath((int) Tcr)) {
+                        if (rand_uniform(0, 1, &cbg) > n->on_day((int) Tcr).Pdeath) {
                             // Critical and recovered
-                            Thc = rand_exp(n->get_Krec((int) Tcr, 3), &cbg) + Tcr;
-                            add_event(Thc, HPC, n, n, det_flag);
+                            Thc = rand_exp(n->on_day((int) Tcr).Krec[3], &cbg) + Tcr;
+                            add_event(Thc, HPC, n->id, n->id, det_flag);
 
-                            Tr = rand_exp(n->get_Krec((int) Thc, 4), &cbg) + Thc;
-                            add_event(Tr, RECC, n, n, det_flag);
+                            Tr = rand_exp(n->on_day((int) Thc).Krec[4], &cbg) + Thc;
+                            add_event(Tr, RECC, n->id, n->id, det_flag);
                         } else {
                             // Critical and die
                             Tr = rand_exp(n->Kdeath, &cbg) + Tcr;
-                            add_event(Tr, DEA, n, n, det_flag);
+                            add_event(Tr, DEA, n->id, n->id, det_flag);
                         } 
                     }
 
@@ -489,32 +775,24 @@ class Event_Driven_NUCOVID {
                 Ti = Tasym;
                 
                 // pre-detection phase
-                add_event(Tasym, ASY, n, n, det_flag);
+                add_event(Tasym, ASY, n->id, n->id, det_flag);
                 Times.push_back(Ti);
                 Ki_modifier.push_back(n->frac_infectiousness_As);
                 
                 // detection phase
-                double Tdet = rand_exp(1/n->time_to_detect[0], &cbg) + Ti;
-                if (not det_flag) det_flag = rand_uniform(0, 1, &cbg) < n->get_Pdet((int) Ti, 0);
+                double Tdet = rand_exp(n->Kdetect[0], &cbg) + Ti;
+                if (not det_flag) det_flag = rand_uniform(0, 1, &cbg) < n->on_day((int) Ti).Pdet[0];
                 Times.push_back(Tdet);
                 Ki_modifier.push_back(det_flag ? n->frac_infectiousness_det : n->frac_infectiousness_As);
                 //Ki_modifier.push_back(det_flag ? n->frac_infectiousness_det * n->frac_infectiousness_As : n->frac_infectiousness_As);
 
                 // time to recovery
-                Tr = rand_exp(inv_adj_inv(n->get_Krec((int) Ti, 0), n->time_to_detect[0]), &cbg) + Tdet;
-                add_event(Tr, RECA, n, n, det_flag);
+                Tr = rand_exp(n->on_day((int) Ti).Krec_asym_adj, &cbg) + Tdet;
+                add_event(Tr, RECA, n->id, n->id, det_flag);
             }
             
             // time to next contact
-            int bin = 0;
-            double Tc = rand_exp(n->get_Ki((int) Ti) * Ki_modifier[bin], &cbg) + Ti;
-            while ( Tc < Tr ) {     // does contact occur before recovery?
-                // decide which node to infect
-                size_t infect_node_id = get_infection_node_id(n->id, cbg);
-                add_event(Tc, CON, n, nodes[infect_node_id], det_flag); // potential transmission event
-                while (bin < Times.size() - 1 and Times[bin+1] < Tc) {bin++;} // update bin if necessary
-                Tc += rand_exp(n->get_Ki((int) Tc) * Ki_modifier[bin], &cbg);
-            }
+            schedule_contacts(n, Times, Ki_modifier, Tr, det_flag, cbg);
             
             // time to become susceptible again (not used for now)
             //double Ts = Tr + immunity_duration; 
@@ -522,127 +800,252 @@ class Event_Driven_NUCOVID {
             //return;
         }
 
+        // Contacts of an individual who is infectious from Times[0] until Tr,
+        // with infectiousness Ki_modifier[i] from Times[i] on.
+        template<typename RNG_T>
+        void schedule_contacts(Node* n, vector<double>& Times, vector<double>& Ki_modifier,
+                               double Tr, bool det_flag, RNG_T& cbg) {
+            if (aggregate_contacts) {
+                schedule_pressure(n, Times, Ki_modifier, Tr, det_flag);
+                return;
+            }
+            if (lazy_contacts) {
+                start_contacts(n, Times, Ki_modifier, Tr, det_flag, cbg);
+                return;
+            }
+            size_t bin = 0;
+            double Tc = rand_exp(n->on_day((int) Times[0]).Ki * Ki_modifier[bin], &cbg) + Times[0];
+            while ( Tc < Tr ) {     // does contact occur before recovery?
+                // decide which node to infect
+                size_t infect_node_id = get_infection_node_id(n->id, cbg);
+                add_event(Tc, CON, n->id, infect_node_id, det_flag); // potential transmission event
+                while (bin < Times.size() - 1 and Times[bin+1] < Tc) {bin++;} // update bin if necessary
+                Tc += rand_exp(n->on_day((int) Tc).Ki * Ki_modifier[bin], &cbg);
+            }
+        }
+
+        // infectiousness class of multiplier Ki_modifier in node n
+        static int pressure_class(const Node* n, double Ki_modifier) {
+            if (Ki_modifier == n->frac_infectiousness_det) return PC_DET;
+            if (Ki_modifier == n->frac_infectiousness_As) return PC_AS;
+            return PC_UNDET;
+        }
+
+        // With aggregate_contacts, the individual's schedule is kept in a
+        // ContactProcess and only the times at which it changes
+        // infectiousness class, and Tr, are queued, as PRS events of that
+        // process.
+        void schedule_pressure(Node* n, vector<double>& Times, vector<double>& Ki_modifier,
+                               double Tr, bool det_flag) {
+            const int cid = new_contact_process(n, Times, Ki_modifier, Tr, det_flag);
+            const ContactProcess& cp = contacts[cid];
+            int cls = PC_NONE;
+            for (size_t bin = 0; bin < cp.Times.size(); bin++) {
+                const int next = pressure_class(n, cp.Ki_modifier[bin]);
+                if (next == cls) continue;
+                add_event(cp.Times[bin], PRS, n->id, n->id, det_flag, cid);
+                cls = next;
+            }
+            add_event(Tr, PRS, n->id, n->id, det_flag, cid);
+        }
+
+        // a slot in contacts for an individual's schedule (Times and
+        // Ki_modifier are taken over)
+        int new_contact_process(Node* n, vector<double>& Times, vector<double>& Ki_modifier, double Tr, bool det_flag) {
+            int cid;
+            if (free_contacts.empty()) {
+                cid = contacts.size();
+                contacts.push_back(ContactProcess());
+            } else {
+                cid = free_contacts.back();
+                free_contacts.pop_back();
+            }
+            if (cid > Event::MAX_CONTACT_ID) {
+                cerr << "ERROR: Too many concurrent contact processes for packed Event (" << cid << ")\n";
+                exit(-1);
+            }
+            ContactProcess& cp = contacts[cid];
+            cp.node = n->id;
+            cp.Tr = Tr;
+            cp.detect = det_flag;
+            cp.bin = 0;
+            cp.Times.swap(Times);
+            cp.Ki_modifier.swap(Ki_modifier);
+            return cid;
+        }
+
+        // Lazy counterpart of the contact loop in infect(): queue only the first
+        // contact and keep what is needed to draw the rest in a ContactProcess.
+        template<typename RNG_T>
+        void start_contacts(Node* n, vector<double>& Times, vector<double>& Ki_modifier,
+                            double Tr, bool det_flag, RNG_T& cbg) {
+            double Tc = rand_exp(n->on_day((int) Times[0]).Ki * Ki_modifier[0], &cbg) + Times[0];
+            if (Tc >= Tr) return;   // recovers before the first contact
+
+            const int cid = new_contact_process(n, Times, Ki_modifier, Tr, det_flag);
+            size_t infect_node_id = get_infection_node_id(n->id, cbg);
+            add_event(Tc, CON, n->id, infect_node_id, det_flag, cid);
+        }
+
+        // Called when the CON event of contact process cid fires at time Now.
+        template<typename RNG_T>
+        void next_contact(int cid, RNG_T& cbg) {
+            ContactProcess& cp = contacts[cid];
+            double Tc = Now;
+            while (cp.bin < cp.Times.size() - 1 and cp.Times[cp.bin+1] < Tc) {cp.bin++;} // update bin if necessary
+            Tc += rand_exp(nodes[cp.node]->on_day((int) Tc).Ki * cp.Ki_modifier[cp.bin], &cbg);
+            if (Tc < cp.Tr) {
+                size_t infect_node_id = get_infection_node_id(cp.node, cbg);
+                add_event(Tc, CON, cp.node, infect_node_id, cp.detect, cid);
+            } else {
+                free_contacts.push_back(cid);
+            }
+        }
+
+        template<typename RNG_T>
+        void contact(const Event& event, Node* source_node, Node* target_node, RNG_T& cbg) {
+            transmit(source_node, target_node, cbg);
+            if (event.contact_id() >= 0) next_contact(event.contact_id(), cbg);
+        }
+
+        // a contact of someone in source_node with someone in target_node at Now
+        template<typename RNG_T>
+        void transmit(Node* source_node, Node* target_node, RNG_T& cbg) {
+            // std::cout << Now << ": " << rng() << std::endl;
+            // const int rand_contact = rand_uniform_int(0, target_node->N, &rng);
+            const int rand_contact = rand_uniform_int(0, target_node->N, &cbg);
+            if (rand_contact < target_node->state_counts[SUSCEPTIBLE]) {
+                if (not target_node->id == source_node->id) target_node->introduced++;
+                if (divert_infections) {
+                    target_node->state_counts[SUSCEPTIBLE]--;
+                    target_node->state_counts[EXPOSED]++;
+                    (*divert_infections)[target_node->id]++;
+                } else {
+                    infect(target_node, cbg);
+                }
+            }
+        }
+
         int next_event() {
             if ( EventQ.empty() ) return 0;
-            Event event = EventQ.top(); // get the element
-            EventQ.pop();               // remove from Q
+            const Event event = EventQ.pop();   // remove from Q
+            Node* source_node = nodes[event.source].get();
+            Node* target_node = nodes[event.target].get();
 
             Now = event.time;           // advance time
             //cerr << "Time: " << Now << " Event: " << event.type << endl;
             switch(event.type) {
                 case PRE:
-                    event.source_node->state_counts[EXPOSED]--;      // decrement exposed class
-                    event.target_node->state_counts[PRESYMPTOMATIC]++;   // increment symptomatic class
+                    source_node->state_counts[EXPOSED]--;      // decrement exposed class
+                    target_node->state_counts[PRESYMPTOMATIC]++;   // increment symptomatic class
                     break;
                 case ASY:
-                    event.source_node->state_counts[EXPOSED]--;      // decrement exposed class
-                    event.target_node->state_counts[ASYMPTOMATIC]++;   // increment asymptomatic class
+                    source_node->state_counts[EXPOSED]--;      // decrement exposed class
+                    target_node->state_counts[ASYMPTOMATIC]++;   // increment asymptomatic class
                     break;
                 case SYMM:
-                    event.source_node->state_counts[PRESYMPTOMATIC]--;      // decrement exposed class
-                    event.target_node->state_counts[SYMPTOMATIC_MILD]++;   // increment symptomatic class
-                    event.target_node->cumu_symptomatic++;
+                    source_node->state_counts[PRESYMPTOMATIC]--;      // decrement exposed class
+                    target_node->state_counts[SYMPTOMATIC_MILD]++;   // increment symptomatic class
+                    target_node->cumu_symptomatic++;
                     break;
                 case SYMS:
-                    event.source_node->state_counts[PRESYMPTOMATIC]--;      // decrement exposed class
-                    event.target_node->state_counts[SYMPTOMATIC_SEVERE]++;   // increment symptomatic class
-                    //event.target_node->cumu_symptomatic++;
+                    source_node->state_counts[PRESYMPTOMATIC]--;      // decrement exposed class
+                    target_node->state_counts[SYMPTOMATIC_SEVERE]++;   // increment symptomatic class
+                    //target_node->cumu_symptomatic++;
                     break;
                 case HOS:
-                    event.source_node->state_counts[SYMPTOMATIC_SEVERE]--;      // decrement exposed class
-                    event.target_node->state_counts[HOSPITALIZED]++;   // increment symptomatic class
-                    event.target_node->cumu_admission++;
+                    source_node->state_counts[SYMPTOMATIC_SEVERE]--;      // decrement exposed class
+                    target_node->state_counts[HOSPITALIZED]++;   // increment symptomatic class
+                    target_node->cumu_admission++;
                     break;
                 case CRI:
-                    event.source_node->state_counts[HOSPITALIZED]--;      // decrement exposed class
-                    event.target_node->state_counts[CRITICAL]++;   // increment symptomatic class
+                    source_node->state_counts[HOSPITALIZED]--;      // decrement exposed class
+                    target_node->state_counts[CRITICAL]++;   // increment symptomatic class
                     break;
                 case HPC:
-                    event.source_node->state_counts[CRITICAL]--;      // decrement exposed class
-                    event.target_node->state_counts[HOSPITALIZED_CRIT]++;   // increment symptomatic class
+                    source_node->state_counts[CRITICAL]--;      // decrement exposed class
+                    target_node->state_counts[HOSPITALIZED_CRIT]++;   // increment symptomatic class
                     break;
                 case DEA:
-                    event.source_node->state_counts[CRITICAL]--;      // decrement exposed class
-                    event.target_node->state_counts[DEATH]++;   // increment symptomatic class
+                    source_node->state_counts[CRITICAL]--;      // decrement exposed class
+                    target_node->state_counts[DEATH]++;   // increment symptomatic class
                     break;
                 case RECA:
-                    event.source_node->state_counts[ASYMPTOMATIC]--;      // decrement asymptomatic class
-                    event.target_node->state_counts[RESISTANT]++;   // increment recovery class
+                    source_node->state_counts[ASYMPTOMATIC]--;      // decrement asymptomatic class
+                    target_node->state_counts[RESISTANT]++;   // increment recovery class
                     break;
                 case RECM:
-                    event.source_node->state_counts[SYMPTOMATIC_MILD]--;      // decrement symptomatic class
-                    event.target_node->state_counts[RESISTANT]++;   // increment recovery class
+                    source_node->state_counts[SYMPTOMATIC_MILD]--;      // decrement symptomatic class
+                    target_node->state_counts[RESISTANT]++;   // increment recovery class
                     break;
                 case RECH:
-                    event.source_node->state_counts[HOSPITALIZED]--;      // decrement symptomatic class
-                    event.target_node->state_counts[RESISTANT]++;   // increment recovery class
+                    source_node->state_counts[HOSPITALIZED]--;      // decrement symptomatic class
+                    target_node->state_counts[RESISTANT]++;   // increment recovery class
                     break;
                 case RECC:
-                    event.source_node->state_counts[HOSPITALIZED_CRIT]--;      // decrement symptomatic class
-                    event.target_node->state_counts[RESISTANT]++;   // increment recovery class
+                    source_node->state_counts[HOSPITALIZED_CRIT]--;      // decrement symptomatic class
+                    target_node->state_counts[RESISTANT]++;   // increment recovery class
                     break;
                 case IMM:
-                    event.source_node->state_counts[RESISTANT]--;      // decrement recovery class
-                    event.target_node->state_counts[SUSCEPTIBLE]++;   // increment susceptible class
+                    source_node->state_counts[RESISTANT]--;      // decrement recovery class
+                    target_node->state_counts[SUSCEPTIBLE]++;   // increment susceptible class
                     break;
                 case CON:
-                    {
+                    if (counter_rng) {
+                        Philox4x32 gen(rng_key, rng_counter++);
+                        contact(event, source_node, target_node, gen);
+                    } else {
                         CachedBitGenerator cbg(rng, 250);
-                        // std::cout << Now << ": " << rng() << std::endl;
-                        // const int rand_contact = rand_uniform_int(0, event.target_node->N, &rng);
-                        const int rand_contact = rand_uniform_int(0, event.target_node->N, &cbg);
-                        if (rand_contact < event.target_node->state_counts[SUSCEPTIBLE]) {
-                            if (not event.target_node->id == event.source_node->id) event.target_node->introduced++;
-                            infect(event.target_node, cbg);
-                        }
-
+                        contact(event, source_node, target_node, cbg);
                         // std::cout << Now << ": " << cbg.calls << std::endl;
                     }
                     break;
                 default:    
                     cerr << "Unknown event type encountered in simulator: " << event.type << "\nQuitting.\n";
             }
+            flush_events();
             return 1;
         }
 
-        void add_event( double time, eventType type, shared_ptr<Node> sn, shared_ptr<Node> tn, bool detect) {
+        void add_event( double time, eventType type, int sn, int tn, bool detect, int contact_id = -1) {
             // std::cout << "evt: " << time << std::endl;
-            EventQ.push( Event(time,type,sn,tn,detect) );
+            pending_events.push_back( Event(time,type,sn,tn,detect,contact_id) );
             return;
         }
 
+        // hand the batch of events drawn by infect()/next_contact() to the queue
+        void flush_events() {
+            if (pending_events.empty()) return;
+            EventQ.push_bulk(pending_events);
+            pending_events.clear();
+        }
+
+        // The layout is CEREAL_ARCHIVE_VERSION's (below); archives of any
+        // other are rejected with a cereal::Exception.
         template<class Archive>
-        void serialize(Archive & archive) {
+        void serialize(Archive & archive, const uint32_t version) {
+            if (version != CEREAL_ARCHIVE_VERSION) {
+                throw cereal::Exception("cereal checkpoint of layout " + to_string(version) + ", expected " +
+                                        to_string(CEREAL_ARCHIVE_VERSION) + "; checkpoints written before the"
+                                        " layout was versioned cannot be restored");
+            }
+            flush_events();
             archive( nodes, infection_matrix, EventQ, Now, offset );
-            archive(rng);
+            build_infection_tables();
+            archive( counter_rng, rng_key, rng_counter );
+            if (not counter_rng) archive(rng);
+            archive( lazy_contacts, contacts, free_contacts );
         }
 
 };
 
-bool fileExists(const std::string& filename) {
-    struct stat buf;
-    return stat(filename.c_str(), &buf) != -1;
-}
-
-void write_buffer(vector<string>& buffer, string filename, bool overwrite) {
-    string all_output;
-    for (const auto &line : buffer) all_output += (line + "\n");
+CEREAL_CLASS_VERSION(Event_Driven_NUCOVID, CEREAL_ARCHIVE_VERSION);
 
-    if (fileExists(filename) and not overwrite) {
-        cerr << "WARNING: Daily output file already exists: " << filename << endl << "WARNING: Aborting write.\n";
-        return;
-    }
-
-    ofstream file;
-    file.open(filename);
-
-    if (file.is_open()) {  // TODO - add this check everywhere a file is opened
-        file << all_output;
-        file.close();
-    } else {
-        cerr << "ERROR: Could not open daily buffer file for output: " << filename << endl;
-        exit(-842);
-    }
+// false if the file was not written
+inline bool write_buffer(vector<string>& buffer, string filename, bool overwrite) {
+    StreamWriter file(filename, overwrite);
+    for (const auto &line : buffer) file.write(line);
+    return file.close();
 }
 
 #endif
@@ -0,0 +1,581 @@
+#ifndef NUCOVID_CHECKPOINT_H
+#define NUCOVID_CHECKPOINT_H
+
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "NUCOVID_cereal.h"
+
+// Flat checkpoint format for Event_Driven_NUCOVID.  A fixed header is
+// followed by sections of plain arrays, each starting on an 8-byte boundary:
+//
+//     CheckpointNode[n_nodes]
+//     double infection_matrix[n_nodes * n_nodes]
+//     double node_values[n_node_values]        Ki, Krec, Pcrit, Pdeath, Pdetect, time_to_detect per node
+//     Event events[n_events]                   the packed 16-byte events, as queued
+//     CheckpointContact contacts[n_contacts]   lazy contact processes
+//     double contact_values[n_contact_values]  Times then Ki_modifier per contact process
+//     int32_t free_contacts[n_free_contacts]
+//     char rng[rng_bytes]                      mt19937 state, only without counter_rng
+//
+// Restoring maps the file and copies each section in one go, with no
+// allocation per event.  The format is native-endian and the RNG state is
+// the raw mt19937 object, so a checkpoint is meant to be read by a build of
+// the same code on the same kind of machine; the header records enough to
+// refuse anything else.
+
+const char CHECKPOINT_MAGIC[8] = {'N', 'U', 'C', 'K', 'P', 'T', '\0', '\0'};
+const uint32_t CHECKPOINT_VERSION = 1;
+
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_bytes;      // sizeof(CheckpointHeader)
+    uint32_t event_bytes;       // sizeof(Event)
+    uint32_t rng_bytes;         // sizeof(mt19937), 0 with counter_rng
+    double Now;
+    double offset;
+    uint64_t rng_key;
+    uint64_t rng_counter;
+    uint8_t counter_rng;
+    uint8_t lazy_contacts;
+    uint8_t queue_type;
+    uint8_t pad[5];
+    uint64_t n_nodes;
+    uint64_t n_node_values;
+    uint64_t n_events;
+    uint64_t n_contacts;
+    uint64_t n_contact_values;
+    uint64_t n_free_contacts;
+    uint64_t file_bytes;
+};
+
+struct CheckpointNode {
+    int32_t id;
+    int32_t N;
+    double Kasym, Kpres, Kmild, Ksevere, Khosp, Kcrit, Kdeath;
+    double frac_infectiousness_As;
+    double frac_infectiousness_det;
+    uint64_t cumu_symptomatic;
+    uint64_t cumu_admission;
+    uint64_t introduced;
+    int32_t state_counts[STATE_SIZE];
+    // lengths of the tables in node_values, which start at values
+    uint32_t n_Ki, n_Krec, n_Pcrit, n_Pdeath, n_Pdetect, n_time_to_detect;
+    uint64_t values;
+};
+
+struct CheckpointContact {
+    int32_t node;
+    int32_t detect;
+    double Tr;
+    uint64_t bin;
+    uint64_t n_times;
+    uint64_t values;            // Times at values, Ki_modifier at values + n_times
+};
+
+static_assert(std::is_trivially_copyable<mt19937>::value, "mt19937 state is saved as raw bytes");
+
+const int KREC_COLS = 5;
+const int PDETECT_COLS = 4;
+
+inline size_t checkpoint_align(size_t bytes) { return (bytes + 7) & ~(size_t) 7; }
+
+// section sizes, in file order
+inline vector<size_t> checkpoint_sections(const CheckpointHeader& h) {
+    return { h.n_nodes * sizeof(CheckpointNode), h.n_nodes * h.n_nodes * sizeof(double),
+             h.n_node_values * sizeof(double), h.n_events * sizeof(Event),
+             h.n_contacts * sizeof(CheckpointContact), h.n_contact_values * sizeof(double),
+             h.n_free_contacts * sizeof(int32_t), h.rng_bytes };
+}
+
+// Write sim to fname (via fname.tmp and a rename, so a crash never leaves a
+// truncated checkpoint).  Returns 0 on success.
+inline int save_checkpoint(Event_Driven_NUCOVID& sim, const string& fname) {
+    sim.flush_events();
+    const size_t nn = sim.nodes.size();
+
+    CheckpointHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+    h.version = CHECKPOINT_VERSION;
+    h.header_bytes = sizeof(CheckpointHeader);
+    h.event_bytes = sizeof(Event);
+    h.rng_bytes = sim.counter_rng ? 0 : sizeof(mt19937);
+    h.Now = sim.Now;
+    h.offset = sim.offset;
+    h.rng_key = sim.rng_key;
+    h.rng_counter = sim.rng_counter;
+    h.counter_rng = sim.counter_rng;
+    h.lazy_contacts = sim.lazy_contacts;
+    h.queue_type = sim.EventQ.type();
+    h.n_nodes = nn;
+
+    vector<CheckpointNode> nodes(nn);
+    vector<double> matrix;
+    vector<double> node_values;
+    for (size_t i = 0; i < nn; i++) {
+        const Node* n = sim.nodes[i].get();
+        CheckpointNode& r = nodes[i];
+        memset(&r, 0, sizeof(r));
+        r.id = n->id;
+        r.N = n->N;
+        r.Kasym = n->Kasym;
+        r.Kpres = n->Kpres;
+        r.Kmild = n->Kmild;
+        r.Ksevere = n->Ksevere;
+        r.Khosp = n->Khosp;
+        r.Kcrit = n->Kcrit;
+        r.Kdeath = n->Kdeath;
+        r.frac_infectiousness_As = n->frac_infectiousness_As;
+        r.frac_infectiousness_det = n->frac_infectiousness_det;
+        r.cumu_symptomatic = n->cumu_symptomatic;
+        r.cumu_admission = n->cumu_admission;
+        r.introduced = n->introduced;
+        for (int s = 0; s < STATE_SIZE; s++) r.state_counts[s] = n->state_counts[s];
+        r.n_Ki = n->Ki.size();
+        r.n_Krec = n->Krec->size();
+        r.n_Pcrit = n->Pcrit.size();
+        r.n_Pdeath = n->Pdeath.size();
+        r.n_Pdetect = n->Pdetect->size();
+        r.n_time_to_detect = n->time_to_detect.size();
+        r.values = node_values.size();
+        node_values.insert(node_values.end(), n->Ki.begin(), n->Ki.end());
+        for (const auto& row : *n->Krec) {
+            if (row.size() != KREC_COLS) {
+                cerr << "ERROR: Cannot checkpoint a Krec row of size " << row.size() << endl;
+                return -1;
+            }
+            node_values.insert(node_values.end(), row.begin(), row.end());
+        }
+        node_values.insert(node_values.end(), n->Pcrit.begin(), n->Pcrit.end());
+        node_values.insert(node_values.end(), n->Pdeath.begin(), n->Pdeath.end());
+        for (const auto& row : *n->Pdetect) {
+            if (row.size() != PDETECT_COLS) {
+                cerr << "ERROR: Cannot checkpoint a Pdetect row of size " << row.size() << endl;
+                return -1;
+            }
+            node_values.insert(node_values.end(), row.begin(), row.end());
+        }
+        node_values.insert(node_values.end(), n->time_to_detect.begin(), n->time_to_detect.end());
+        matrix.insert(matrix.end(), sim.infection_matrix[i].begin(), sim.infection_matrix[i].end());
+    }
+    h.n_node_values = node_values.size();
+
+    vector<Event> events;
+    events.reserve(sim.EventQ.size());
+    sim.EventQ.dump(events);
+    h.n_events = events.size();
+
+    vector<CheckpointContact> contacts(sim.contacts.size());
+    vector<double> contact_values;
+    for (size_t c = 0; c < sim.contacts.size(); c++) {
+        const ContactProcess& cp = sim.contacts[c];
+        CheckpointContact& r = contacts[c];
+        memset(&r, 0, sizeof(r));
+        r.node = cp.node;
+        r.detect = cp.detect;
+        r.Tr = cp.Tr;
+        r.bin = cp.bin;
+        r.n_times = cp.Times.size();
+        r.values = contact_values.size();
+        contact_values.insert(contact_values.end(), cp.Times.begin(), cp.Times.end());
+        contact_values.insert(contact_values.end(), cp.Ki_modifier.begin(), cp.Ki_modifier.end());
+    }
+    h.n_contacts = contacts.size();
+    h.n_contact_values = contact_values.size();
+    vector<int32_t> free_contacts(sim.free_contacts.begin(), sim.free_contacts.end());
+    h.n_free_contacts = free_contacts.size();
+
+    const vector<size_t> sizes = checkpoint_sections(h);
+    h.file_bytes = checkpoint_align(sizeof(h));
+    for (size_t s : sizes) h.file_bytes += checkpoint_align(s);
+
+    const void* data[] = { nodes.data(), matrix.data(), node_values.data(), events.data(),
+                           contacts.data(), contact_values.data(), free_contacts.data(), &sim.rng };
+    const string tmp_fname = fname + ".tmp";
+    FILE* file = fopen(tmp_fname.c_str(), "wb");
+    if (file == NULL) {
+        cerr << "ERROR: Could not open checkpoint file for output: " << tmp_fname << endl;
+        return -1;
+    }
+    const char zeros[8] = {0};
+    bool ok = fwrite(&h, sizeof(h), 1, file) == 1;
+    ok = ok and fwrite(zeros, 1, checkpoint_align(sizeof(h)) - sizeof(h), file) == checkpoint_align(sizeof(h)) - sizeof(h);
+    for (size_t s = 0; s < sizes.size() and ok; s++) {
+        if (sizes[s] == 0) continue;
+        ok = fwrite(data[s], 1, sizes[s], file) == sizes[s];
+        const size_t pad = checkpoint_align(sizes[s]) - sizes[s];
+        ok = ok and fwrite(zeros, 1, pad, file) == pad;
+    }
+    ok = (fclose(file) == 0) and ok;
+    if (not ok or rename(tmp_fname.c_str(), fname.c_str()) != 0) {
+        cerr << "ERROR: Could not write checkpoint file: " << fname << endl;
+        remove(tmp_fname.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+inline bool is_flat_checkpoint(const string& fname) {
+    char magic[sizeof(CHECKPOINT_MAGIC)] = {0};
+    ifstream file(fname, ios::binary);
+    file.read(magic, sizeof(magic));
+    return file and memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) == 0;
+}
+
+// Replace the state of sim with the checkpoint in fname.  Returns 0 on
+// success; on failure sim is left unchanged.
+inline int load_checkpoint(Event_Driven_NUCOVID& sim, const string& fname) {
+    int fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "ERROR: Could not open checkpoint file: " << fname << endl;
+        return -1;
+    }
+    const off_t file_bytes = lseek(fd, 0, SEEK_END);
+    if (file_bytes < (off_t) sizeof(CheckpointHeader)) {
+        cerr << "ERROR: Checkpoint file is too short: " << fname << endl;
+        close(fd);
+        return -1;
+    }
+    void* map = mmap(NULL, file_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        cerr << "ERROR: Could not map checkpoint file: " << fname << endl;
+        return -1;
+    }
+    const char* base = (const char*) map;
+    const CheckpointHeader& h = *(const CheckpointHeader*) base;
+
+    string problem;
+    if (memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic)) != 0) problem = "not a checkpoint";
+    else if (h.version != CHECKPOINT_VERSION) problem = "unsupported version " + to_string(h.version);
+    else if (h.header_bytes != sizeof(CheckpointHeader) or h.event_bytes != sizeof(Event)) problem = "written by an incompatible build";
+    else if (h.rng_bytes != 0 and h.rng_bytes != sizeof(mt19937)) problem = "RNG state from an incompatible build";
+    else if (h.file_bytes != (uint64_t) file_bytes) problem = "truncated";
+    else if (h.n_nodes > Event::MAX_NODES) problem = "too many nodes";
+    else if (max({h.n_nodes * h.n_nodes, h.n_node_values, h.n_events, h.n_contacts, h.n_contact_values,
+                  h.n_free_contacts}) > (uint64_t) file_bytes) problem = "corrupt section sizes";
+    if (problem.empty()) {
+        // every section must fit in the file (guards against corrupt counts)
+        uint64_t bytes = checkpoint_align(sizeof(h));
+        for (size_t s : checkpoint_sections(h)) bytes += checkpoint_align(s);
+        if (bytes != h.file_bytes) problem = "corrupt section sizes";
+    }
+    if (not problem.empty()) {
+        cerr << "ERROR: Cannot restore " << fname << ": " << problem << endl;
+        munmap(map, file_bytes);
+        return -1;
+    }
+
+    const char* section[8];
+    const vector<size_t> sizes = checkpoint_sections(h);
+    const char* p = base + checkpoint_align(sizeof(h));
+    for (size_t s = 0; s < sizes.size(); s++) {
+        section[s] = p;
+        p += checkpoint_align(sizes[s]);
+    }
+    const CheckpointNode* nodes = (const CheckpointNode*) section[0];
+    const double* matrix = (const double*) section[1];
+    const double* node_values = (const double*) section[2];
+    const Event* events = (const Event*) section[3];
+    const CheckpointContact* contacts = (const CheckpointContact*) section[4];
+    const double* contact_values = (const double*) section[5];
+    const int32_t* free_contacts = (const int32_t*) section[6];
+
+    // everything used as an index must be in range
+    for (size_t i = 0; i < h.n_nodes and problem.empty(); i++) {
+        const CheckpointNode& r = nodes[i];
+        uint64_t need = r.n_Ki + (uint64_t) r.n_Krec * KREC_COLS + r.n_Pcrit + r.n_Pdeath +
+                        (uint64_t) r.n_Pdetect * PDETECT_COLS + r.n_time_to_detect;
+        if (r.values + need > h.n_node_values or r.n_Ki == 0 or r.n_Krec == 0 or r.n_Pcrit == 0 or
+            r.n_Pdeath == 0 or r.n_Pdetect == 0 or r.n_time_to_detect < 3 or r.id < 0 or (uint64_t) r.id >= h.n_nodes) {
+            problem = "corrupt node table";
+        }
+    }
+    for (size_t c = 0; c < h.n_contacts and problem.empty(); c++) {
+        const CheckpointContact& r = contacts[c];
+        if (r.values + 2 * r.n_times > h.n_contact_values or r.node < 0 or (uint64_t) r.node >= h.n_nodes or
+            (r.n_times > 0 and r.bin >= r.n_times)) {
+            problem = "corrupt contact table";
+        }
+    }
+    for (size_t e = 0; e < h.n_events and problem.empty(); e++) {
+        const Event& r = events[e];
+        if (r.type > PRS or r.source >= h.n_nodes or r.target >= h.n_nodes or
+            r.contact_id() >= (int64_t) h.n_contacts) {
+            problem = "corrupt event queue";
+        }
+    }
+    for (size_t f = 0; f < h.n_free_contacts and problem.empty(); f++) {
+        if (free_contacts[f] < 0 or free_contacts[f] >= (int64_t) h.n_contacts) problem = "corrupt free contact list";
+    }
+    if (not problem.empty()) {
+        cerr << "ERROR: Cannot restore " << fname << ": " << problem << endl;
+        munmap(map, file_bytes);
+        return -1;
+    }
+
+    sim.reset();
+    sim.nodes.clear();
+    sim.infection_matrix.assign(h.n_nodes, vector<double>());
+    for (size_t i = 0; i < h.n_nodes; i++) {
+        const CheckpointNode& r = nodes[i];
+        shared_ptr<Node> n = make_shared<Node>();
+        n->id = r.id;
+        n->N = r.N;
+        n->Kasym = r.Kasym;
+        n->Kpres = r.Kpres;
+        n->Kmild = r.Kmild;
+        n->Ksevere = r.Ksevere;
+        n->Khosp = r.Khosp;
+        n->Kcrit = r.Kcrit;
+        n->Kdeath = r.Kdeath;
+        n->frac_infectiousness_As = r.frac_infectiousness_As;
+        n->frac_infectiousness_det = r.frac_infectiousness_det;
+        n->cumu_symptomatic = r.cumu_symptomatic;
+        n->cumu_admission = r.cumu_admission;
+        n->introduced = r.introduced;
+        n->state_counts.assign(r.state_counts, r.state_counts + STATE_SIZE);
+        const double* v = node_values + r.values;
+        n->Ki.assign(v, v + r.n_Ki);
+        v += r.n_Ki;
+        vector<vector<double>> krec(r.n_Krec);
+        for (auto& row : krec) {
+            row.assign(v, v + KREC_COLS);
+            v += KREC_COLS;
+        }
+        n->Krec = make_shared<const vector<vector<double>>>(std::move(krec));
+        n->Pcrit.assign(v, v + r.n_Pcrit);
+        v += r.n_Pcrit;
+        n->Pdeath.assign(v, v + r.n_Pdeath);
+        v += r.n_Pdeath;
+        vector<vector<double>> pdetect(r.n_Pdetect);
+        for (auto& row : pdetect) {
+            row.assign(v, v + PDETECT_COLS);
+            v += PDETECT_COLS;
+        }
+        n->Pdetect = make_shared<const vector<vector<double>>>(std::move(pdetect));
+        n->time_to_detect.assign(v, v + r.n_time_to_detect);
+        n->build_day_params();
+        sim.nodes.push_back(n);
+        sim.infection_matrix[i].assign(matrix + i * h.n_nodes, matrix + (i + 1) * h.n_nodes);
+    }
+    sim.build_infection_tables();
+
+    sim.Now = h.Now;
+    sim.offset = h.offset;
+    sim.rng_key = h.rng_key;
+    sim.rng_counter = h.rng_counter;
+    sim.counter_rng = h.counter_rng;
+    if (h.rng_bytes) memcpy(&sim.rng, section[7], sizeof(mt19937));
+    sim.lazy_contacts = h.lazy_contacts;
+
+    sim.EventQ.set_type((queueType) h.queue_type);
+    sim.EventQ.push_bulk(events, events + h.n_events);
+
+    sim.contacts.resize(h.n_contacts);
+    for (size_t c = 0; c < h.n_contacts; c++) {
+        const CheckpointContact& r = contacts[c];
+        ContactProcess& cp = sim.contacts[c];
+        cp.node = r.node;
+        cp.detect = r.detect;
+        cp.Tr = r.Tr;
+        cp.bin = r.bin;
+        const double* v = contact_values + r.values;
+        cp.Times.assign(v, v + r.n_times);
+        cp.Ki_modifier.assign(v + r.n_times, v + 2 * r.n_times);
+    }
+    sim.free_contacts.assign(free_contacts, free_contacts + h.n_free_contacts);
+
+    munmap(map, file_bytes);
+    return 0;
+}
+
+// Saves states handed over by add() from a background thread, so the
+// simulation carries on while the files are written, e.g. with
+//
+//     sim.snapshot = [&](int day, Event_Driven_NUCOVID& state) { writer.add(state, fname_for(day)); };
+//
+// save is called for one state at a time, in the order they were added.
+class CheckpointWriter {
+        function<void(Event_Driven_NUCOVID&, const string&)> save;
+        mutex m;
+        condition_variable ready;
+        deque<pair<Event_Driven_NUCOVID, string>> waiting;
+        bool closing;
+        thread writer;
+
+        void write_loop() {
+            unique_lock<mutex> lock(m);
+            while (true) {
+                ready.wait(lock, [this] { return closing or not waiting.empty(); });
+                if (waiting.empty()) return;
+                pair<Event_Driven_NUCOVID, string> job = std::move(waiting.front());
+                waiting.pop_front();
+                lock.unlock();
+                save(job.first, job.second);
+                lock.lock();
+            }
+        }
+
+    public:
+        CheckpointWriter(function<void(Event_Driven_NUCOVID&, const string&)> s) : save(s), closing(false) {
+            writer = thread(&CheckpointWriter::write_loop, this);
+        }
+
+        ~CheckpointWriter() { close(); }
+
+        // takes over state
+        void add(Event_Driven_NUCOVID& state, const string& fname) {
+            lock_guard<mutex> lock(m);
+            waiting.push_back(make_pair(std::move(state), fname));
+            ready.notify_one();
+        }
+
+        // waits for everything added so far to be saved
+        void close() {
+            {
+                lock_guard<mutex> lock(m);
+                if (closing) return;
+                closing = true;
+            }
+            ready.notify_one();
+            writer.join();
+        }
+};
+
+struct StoredCheckpoint {
+    int day;                // the state as a run ending on this day leaves it
+    int reach;              // latest day of per-day parameters it depends on
+    string key;             // ContentHash of all it depends on, see CheckpointStore::entry()
+    string path;            // path + ".ckpt" is the checkpoint, path + ".out" the daily output so far
+};
+
+// A directory of checkpoints, each named by a hash of everything the state
+// depends on: the configuration, the node parameters, the per-day parameters
+// up to the latest day the simulation has looked at (Node::last_day_read),
+// which is usually well past the day of the checkpoint since events are
+// drawn ahead, and the random seeds before the day.  A run with other
+// parameters can continue from any stored state whose key it reproduces,
+// with the same result as simulating the prefix again.  Only runs started
+// the same way (run_from_scratch() in chicago_yr1) may share a store.
+class CheckpointStore {
+        string dir;
+
+        static string key(const Event_Driven_NUCOVID& sim, const std::map<double, int>& seeds, int day, int reach) {
+            ContentHash h;
+            h.add(string(CHECKPOINT_MAGIC, 8));
+            h.add((int64_t) CHECKPOINT_VERSION);
+            h.add((int64_t) day);
+            h.add((int64_t) reach);
+            h.add((int64_t) sim.lazy_contacts);
+            h.add((int64_t) sim.counter_rng);
+            h.add((int64_t) sim.aggregate_contacts);
+            h.add((int64_t) sim.EventQ.type());
+            for (const auto& row : sim.infection_matrix) h.add(row);
+            for (const auto& n : sim.nodes) {
+                h.add((int64_t) n->id);
+                h.add((int64_t) n->N);
+                for (double k : {n->Kasym, n->Kpres, n->Kmild, n->Ksevere, n->Khosp, n->Kcrit, n->Kdeath,
+                                 n->frac_infectiousness_As, n->frac_infectiousness_det}) h.add(k);
+                h.add(n->time_to_detect);
+                for (int d = 0; d <= reach; d++) {
+                    const DayParams p = n->day_row(d);
+                    h.add(&p, sizeof(p));
+                }
+            }
+            for (const auto& s : seeds) {
+                if (s.first >= day) break;
+                h.add(s.first);
+                h.add((int64_t) s.second);
+            }
+            return h.hex();
+        }
+
+    public:
+        CheckpointStore(const string& d) : dir(d) {
+            mkdir(dir.c_str(), 0755);
+        }
+
+        // the entry for the state of sim, a fork() taken at the start of day
+        StoredCheckpoint entry(const Event_Driven_NUCOVID& sim, const std::map<double, int>& seeds, int day) const {
+            StoredCheckpoint c;
+            c.day = day;
+            c.reach = day;
+            for (const auto& n : sim.nodes) c.reach = max(c.reach, n->last_day_read);
+            c.key = key(sim, seeds, day, c.reach);
+            c.path = dir + "/" + to_string(day) + "_" + to_string(c.reach) + "_" + c.key;
+            return c;
+        }
+
+        bool contains(const StoredCheckpoint& c) const {
+            struct stat st;
+            return stat((c.path + ".ckpt").c_str(), &st) == 0 and stat((c.path + ".out").c_str(), &st) == 0;
+        }
+
+        // Latest complete entry up to last_day that sim, freshly set up with
+        // its parameters, would reproduce with seeds.
+        bool find(const Event_Driven_NUCOVID& sim, const std::map<double, int>& seeds, int last_day,
+                  StoredCheckpoint& found) const {
+            DIR* d = opendir(dir.c_str());
+            if (d == NULL) return false;
+            vector<StoredCheckpoint> candidates;
+            while (struct dirent* e = readdir(d)) {
+                StoredCheckpoint c;
+                char k[17];
+                char ext[8];
+                if (sscanf(e->d_name, "%d_%d_%16[0-9a-f].%7s", &c.day, &c.reach, k, ext) != 4) continue;
+                if (strcmp(ext, "ckpt") != 0 or c.day > last_day) continue;
+                c.key = k;
+                c.path = dir + "/" + e->d_name;
+                c.path.resize(c.path.size() - 5);   // ".ckpt"
+                candidates.push_back(c);
+            }
+            closedir(d);
+            sort(candidates.begin(), candidates.end(),
+                 [](const StoredCheckpoint& a, const StoredCheckpoint& b) { return a.day > b.day; });
+            for (const auto& c : candidates) {
+                if (key(sim, seeds, c.day, c.reach) == c.key and contains(c)) {
+                    found = c;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // daily output up to the stored state, header included
+        bool load_output(const StoredCheckpoint& c, vector<string>& lines) const {
+            ifstream file(c.path + ".out");
+            if (not file.is_open()) return false;
+            lines.clear();
+            string line;
+            while (getline(file, line)) lines.push_back(line);
+            return not lines.empty();
+        }
+
+        // written last, as it completes the entry; false if it could not be
+        bool save_output(const StoredCheckpoint& c, const vector<string>& lines) const {
+            const string tmp = c.path + ".out.tmp";
+            ofstream file(tmp);
+            for (const auto& line : lines) file << line << "\n";
+            file.close();
+            if (file.fail() or rename(tmp.c_str(), (c.path + ".out").c_str()) != 0) {
+                cerr << "ERROR: Could not write " << c.path << ".out" << endl;
+                remove(tmp.c_str());
+                return false;
+            }
+            return true;
+        }
+};
+
+#endif
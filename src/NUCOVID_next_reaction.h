@@ -0,0 +1,441 @@
+#ifndef NUCOVID_NEXT_REACTION_H
+#define NUCOVID_NEXT_REACTION_H
+
+#include <map>
+#include "NUCOVID_cereal.h"
+
+// Next-reaction engine: instead of one CON event per contact, most of them
+// rejected once S/N is small, each node keeps the number of infectious
+// individuals in each pressureClass, and infections of node j are a single
+// reaction with rate
+//
+//     a_j = S_j/N_j * sum_i p_ij * Ki_i * (n_As*frac_As + n_det*frac_det + n_undet)
+//
+// where p is the row-normalized infection_matrix.  The reactions are
+// scheduled with the modified next reaction method (Anderson 2007, a
+// variant of Gibson & Bruck) in an IndexedMinHeap, so the number of events
+// grows with the number of infections rather than contacts.  Each
+// infection still costs two or three PRS events, though, so this is only
+// faster than the exact engine when an infectious individual makes many
+// more contacts than that, most of them rejected: with the Chicago
+// defaults (seed 1) it does 4.1M events in 5.4 s to exact's 2.8M in 3.9 s.
+//
+// Everything else about an individual is drawn by
+// Event_Driven_NUCOVID::infect() as usual; with sim.aggregate_contacts it
+// keeps the individual's schedule in a ContactProcess and queues PRS
+// events where it changes class.
+//
+// The exact engine draws each contact gap with the rate in force at the
+// previous contact, so when an individual's rate changes (Ki on a new day,
+// or its infectiousness class) it keeps the old rate until its next
+// contact.  The same holds here: only individuals whose rate is the current
+// one ("fresh") are in the counts above.  One whose rate changes is taken
+// out of them into a StaleGroup of the node's individuals with the same old
+// rate r.  A group of m is one more reaction, of rate m*r: the gaps are
+// exponential, so its next contact is any member's alike.  That contact is
+// made as in the exact engine and puts the member back, at the current
+// rate, while a member that recovers first simply leaves.  The two engines
+// then agree in distribution, and a change of Ki costs a move into a group
+// per infectious individual rather than an event.
+class NextReaction_NUCOVID {
+    public:
+        Event_Driven_NUCOVID& sim;
+        vector<vector<int>> infectious;     // [node][pressureClass], fresh individuals per class
+
+        NextReaction_NUCOVID(Event_Driven_NUCOVID& s) : sim(s) {
+            const size_t nn = sim.nodes.size();
+            infectious.resize(nn, vector<int>(PC_NONE, 0));
+            pressure.resize(nn, 0.0);
+            force.resize(nn, 0.0);
+            hazard.resize(nn, 0.0);
+            integrated.resize(nn, 0.0);
+            fire_at.resize(nn, 0.0);
+            updated.resize(nn, sim.Now);
+            reactions.reset(nn);
+            Ki.resize(nn, NAN);
+            fresh.resize(nn);
+            group_of.resize(nn);
+            sources.resize(nn);
+            targets.resize(nn);
+            for (size_t i = 0; i < nn; i++) {
+                const double row_sum = sum(sim.infection_matrix[i]);
+                for (size_t j = 0; j < nn; j++) {
+                    const double p = sim.infection_matrix[i][j] / row_sum;
+                    if (p == 0) continue;
+                    sources[j].push_back({i, p});
+                    targets[i].push_back(j);
+                }
+            }
+            if (sim.counter_rng) {
+                Philox4x32 gen(sim.rng_key, sim.rng_counter++);
+                for (size_t j = 0; j < nn; j++) fire_at[j] = rand_exp(1.0, &gen);
+            } else {
+                CachedBitGenerator cbg(sim.rng, 100);
+                for (size_t j = 0; j < nn; j++) fire_at[j] = rand_exp(1.0, &cbg);
+            }
+        }
+
+        // Same day bookkeeping, seeding and output as
+        // Event_Driven_NUCOVID::run_simulation().  Individuals must have
+        // been infected with sim.aggregate_contacts set.  A run continues
+        // the last one, as long as the same object makes it: the
+        // infectious individuals are only known here.
+        vector<string> run_simulation(double duration, std::map<double, int> seeds, bool print) {
+            double start_time = sim.Now;
+            double intpart;
+            int day;
+            sim.stopped = false;
+
+            vector<string> out_buffer;
+            string header = "node\ttime\tKi\tS\tE\tAP\tSYM\tHOS\tCRIT\tDEA\tR\tcumu_sym\tcumu_adm\tintroduced";
+            cout << setprecision(3) << fixed;
+            out_buffer.push_back(header);
+            if (print) {cout << header << endl;}
+
+            if ( modf(start_time, &intpart) == 0 ) {
+                day = (int) start_time;
+            } else {
+                day = ceil(start_time);
+            }
+
+            double end_time = start_time + duration + sim.offset;
+            size_t horizon = ceil(end_time) + 1;
+            for (size_t i = 0; i < sim.nodes.size(); i++) {
+                if (sim.nodes[i]->days() < horizon) sim.nodes[i]->build_day_params(horizon);
+            }
+
+            std::cout << "start_time, duration, offset: " << start_time << ", " << duration << ", " << sim.offset << std::endl;
+            refresh(start_time);
+
+            size_t n_events = 0;
+            size_t n_infections = 0;
+            auto wall_start = std::chrono::steady_clock::now();
+            while (true) {
+                double next_event_time = sim.check_next_event_time();
+                if (next_event_time == -1) next_event_time = INFINITY;
+                const double next_infection_time = reactions.top_time();
+                const double next_time = min(next_event_time, next_infection_time);
+                if (next_time == INFINITY or next_time >= end_time) break;
+                if (next_time > day) {
+                    auto iter = seeds.find(static_cast<double>(day));
+                    if (iter != seeds.end()) sim.reseed(iter->second);
+                    sim.print_state(&out_buffer, day, print);
+                    refresh(day);   // Ki of the new day
+                    day++;
+                    if (sim.stopped) break;
+                    continue;
+                }
+
+                if (next_infection_time < next_event_time) {
+                    const size_t k = reactions.top();
+                    if (k < pressure.size()) {
+                        infection(k, next_infection_time);
+                        n_infections++;
+                    } else {
+                        stale_contact(k - pressure.size(), next_infection_time);
+                    }
+                } else if (sim.EventQ.top().type == PRS) {
+                    change_class(sim.EventQ.pop());
+                } else {
+                    sim.next_event();
+                }
+                n_events++;
+            }
+            sim.offset = end_time - sim.Now;
+            std::cout << "duration, now, offset: " << duration << ", " << sim.Now << ", " << sim.offset << std::endl;
+            double wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+            std::cout << "events, infections, wall time: " << n_events << ", " << n_infections << ", " << wall_time << std::endl;
+
+            if (not sim.stopped) sim.print_state(&out_buffer, day, print);
+
+            return out_buffer;
+        }
+
+    private:
+        // an infectious individual, by the id of its ContactProcess
+        struct Carrier {
+            int cls;            // pressureClass
+            bool fresh;         // counted in infectious, at the current rate
+            size_t group;       // its StaleGroup, if infectious and not fresh
+            size_t slot;        // index into fresh[node] if fresh, else into its group's members
+            Carrier() : cls(PC_NONE), fresh(false), group(0), slot(0) {}
+        };
+
+        // a node's stale individuals with the same contact rate
+        struct StaleGroup {
+            size_t node;
+            double rate;            // of each member
+            vector<int> members;    // ids of their ContactProcesses
+        };
+
+        vector<double> pressure;    // [node], contact rate of the node's infectious
+        vector<double> force;       // [node], sum_i p_ij * pressure[i]
+        // one infection reaction per node, then one per StaleGroup;
+        // integrated and fire_at are in units of integrated hazard (the
+        // reaction's internal time)
+        vector<double> hazard;
+        vector<double> integrated;  // integrated hazard up to updated
+        vector<double> fire_at;     // integrated hazard at which the reaction fires next
+        vector<double> updated;
+        IndexedMinHeap reactions;
+        vector<vector<pair<size_t, double>>> sources;  // [target], (source, p) with p > 0
+        vector<vector<size_t>> targets;                 // [source], targets with p > 0
+        vector<double> Ki;                  // [node], of the current day
+        vector<vector<int>> fresh;          // [node], ids of its fresh individuals
+        vector<Carrier> carriers;           // by ContactProcess id
+        vector<StaleGroup> groups;          // reaction nodes.size() + g is group g
+        vector<std::map<double, size_t>> group_of;  // [node], rate -> its group
+
+        double node_pressure(size_t i, double t) const {
+            const Node* n = sim.nodes[i].get();
+            const vector<int>& c = infectious[i];
+            return n->on_day((int) t).Ki * (c[PC_AS] * n->frac_infectiousness_As +
+                                            c[PC_DET] * n->frac_infectiousness_det + c[PC_UNDET]);
+        }
+
+        static double multiplier(const Node* n, int cls) {
+            if (cls == PC_AS) return n->frac_infectiousness_As;
+            if (cls == PC_DET) return n->frac_infectiousness_det;
+            return 1;
+        }
+
+        Carrier& carrier(int cid) {
+            if ((size_t) cid >= carriers.size()) carriers.resize(cid + 1);
+            return carriers[cid];
+        }
+
+        // reaction k has rate h from time t on
+        void set_rate(size_t k, double h, double t) {
+            integrated[k] += hazard[k] * (t - updated[k]);
+            updated[k] = t;
+            hazard[k] = h;
+            reactions.update(k, h > 0 ? t + (fire_at[k] - integrated[k]) / h : INFINITY);
+        }
+
+        // new rate for the infections of node j from time t on
+        void set_hazard(size_t j, double t) {
+            double f = 0;
+            for (const auto& src : sources[j]) f += src.second * pressure[src.first];
+            force[j] = f;
+            const Node* n = sim.nodes[j].get();
+            set_rate(j, f * n->state_counts[SUSCEPTIBLE] / n->N, t);
+        }
+
+        // the contact rate of node i changed at t
+        void update_source(size_t i, double t) {
+            pressure[i] = node_pressure(i, t);
+            for (size_t j : targets[i]) set_hazard(j, t);
+        }
+
+        void add_fresh(size_t i, int cid) {
+            Carrier& c = carriers[cid];
+            c.fresh = true;
+            c.slot = fresh[i].size();
+            fresh[i].push_back(cid);
+            infectious[i][c.cls]++;
+        }
+
+        void remove_fresh(size_t i, int cid) {
+            Carrier& c = carriers[cid];
+            const int last = fresh[i].back();
+            fresh[i][c.slot] = last;
+            carriers[last].slot = c.slot;
+            fresh[i].pop_back();
+            c.fresh = false;
+            infectious[i][c.cls]--;
+        }
+
+        // the group of node i's stale individuals of the given rate, added
+        // at time t if there is none
+        template<typename RNG_T>
+        size_t stale_group(size_t i, double rate, double t, RNG_T& rng) {
+            auto iter = group_of[i].find(rate);
+            if (iter != group_of[i].end()) return iter->second;
+            const size_t g = groups.size();
+            groups.push_back({i, rate, {}});
+            group_of[i][rate] = g;
+            hazard.push_back(0);
+            integrated.push_back(0);
+            fire_at.push_back(rand_exp(1.0, &rng));
+            updated.push_back(t);
+            reactions.add(INFINITY);
+            return g;
+        }
+
+        // group g's rate after its members changed at t
+        void update_group(size_t g, double t) {
+            set_rate(pressure.size() + g, groups[g].members.size() * groups[g].rate, t);
+        }
+
+        // Carrier cid, no longer fresh, keeps the rate of group g, that of
+        // its last contact, until its next one; call update_group() after.
+        void go_stale(int cid, size_t g) {
+            Carrier& c = carriers[cid];
+            c.fresh = false;
+            c.group = g;
+            c.slot = groups[g].members.size();
+            groups[g].members.push_back(cid);
+        }
+
+        void leave_group(int cid) {
+            Carrier& c = carriers[cid];
+            vector<int>& members = groups[c.group].members;
+            const int last = members.back();
+            members[c.slot] = last;
+            carriers[last].slot = c.slot;
+            members.pop_back();
+        }
+
+        void release(int cid) {
+            carriers[cid] = Carrier();
+            sim.free_contacts.push_back(cid);
+        }
+
+        // everything, e.g. when Ki changes at a day boundary; the fresh
+        // individuals of nodes whose Ki changed go stale at their old rates
+        template<typename RNG_T>
+        void refresh(double t, RNG_T& rng) {
+            for (size_t i = 0; i < pressure.size(); i++) {
+                const Node* n = sim.nodes[i].get();
+                const double now = n->on_day((int) t).Ki;
+                if (not std::isnan(Ki[i]) and now != Ki[i] and not fresh[i].empty()) {
+                    size_t g[PC_NONE];
+                    for (int cls = 0; cls < PC_NONE; cls++) g[cls] = stale_group(i, Ki[i] * multiplier(n, cls), t, rng);
+                    for (int cid : fresh[i]) go_stale(cid, g[carriers[cid].cls]);
+                    for (int cls = 0; cls < PC_NONE; cls++) update_group(g[cls], t);
+                    fresh[i].clear();
+                    infectious[i].assign(PC_NONE, 0);
+                }
+                Ki[i] = now;
+            }
+            for (size_t i = 0; i < pressure.size(); i++) pressure[i] = node_pressure(i, t);
+            for (size_t j = 0; j < pressure.size(); j++) set_hazard(j, t);
+        }
+
+        void refresh(double t) {
+            if (sim.counter_rng) {
+                Philox4x32 gen(sim.rng_key, sim.rng_counter++);
+                refresh(t, gen);
+            } else {
+                refresh(t, sim.rng);
+            }
+        }
+
+        // A PRS event: carrier event.contact_id() becomes infectious, changes
+        // class or recovers
+        void change_class(const Event& event) {
+            sim.Now = event.time;
+            if (sim.counter_rng) {
+                Philox4x32 gen(sim.rng_key, sim.rng_counter++);
+                change_class(event, gen);
+            } else {
+                CachedBitGenerator cbg(sim.rng, 10);
+                change_class(event, cbg);
+            }
+            sim.flush_events();
+            update_source(event.source, sim.Now);
+        }
+
+        template<typename RNG_T>
+        void change_class(const Event& event, RNG_T& rng) {
+            const size_t i = event.source;
+            const int cid = event.contact_id();
+            const Node* n = sim.nodes[i].get();
+            ContactProcess& cp = sim.contacts[cid];
+            Carrier& c = carrier(cid);
+            int to = PC_NONE;
+            if (event.time < cp.Tr) {
+                while (cp.bin + 1 < cp.Times.size() and cp.Times[cp.bin + 1] <= event.time) cp.bin++;
+                to = Event_Driven_NUCOVID::pressure_class(n, cp.Ki_modifier[cp.bin]);
+            }
+            if (c.cls == PC_NONE) {
+                // the first contact gap is drawn at the rate in force now
+                c.cls = to;
+                add_fresh(i, cid);
+            } else if (to == PC_NONE) {
+                if (c.fresh) {
+                    remove_fresh(i, cid);
+                } else {
+                    const size_t g = c.group;
+                    leave_group(cid);
+                    update_group(g, sim.Now);
+                }
+                release(cid);
+            } else if (c.fresh and multiplier(n, to) != multiplier(n, c.cls)) {
+                remove_fresh(i, cid);
+                const size_t g = stale_group(i, Ki[i] * multiplier(n, c.cls), sim.Now, rng);
+                go_stale(cid, g);
+                update_group(g, sim.Now);
+                c.cls = to;
+            } else if (c.fresh) {
+                infectious[i][c.cls]--;
+                infectious[i][to]++;
+                c.cls = to;
+            } else {
+                c.cls = to;
+            }
+        }
+
+        // Stale group g fires at t: one of its members makes its contact, as
+        // the exact engine makes it, after which it is fresh again.
+        void stale_contact(size_t g, double t) {
+            sim.Now = t;
+            const size_t i = groups[g].node;
+            int cid;
+            size_t j;
+            if (sim.counter_rng) {
+                Philox4x32 gen(sim.rng_key, sim.rng_counter++);
+                cid = stale_contact(g, j, gen);
+            } else {
+                CachedBitGenerator cbg(sim.rng, 250);
+                cid = stale_contact(g, j, cbg);
+            }
+            sim.flush_events();
+            update_group(g, sim.Now);
+            add_fresh(i, cid);
+            update_source(i, sim.Now);
+            set_hazard(j, sim.Now);
+        }
+
+        // the member that makes the contact, and in j the node contacted
+        template<typename RNG_T>
+        int stale_contact(size_t g, size_t& j, RNG_T& rng) {
+            const vector<int>& members = groups[g].members;
+            const size_t pick = min((size_t) (rand_uniform(0, 1, &rng) * members.size()), members.size() - 1);
+            const int cid = members[pick];
+            leave_group(cid);
+            fire_at[pressure.size() + g] += rand_exp(1.0, &rng);
+            const size_t i = groups[g].node;
+            j = sim.get_infection_node_id(i, rng);
+            sim.transmit(sim.nodes[i].get(), sim.nodes[j].get(), rng);
+            return cid;
+        }
+
+        void infection(size_t j, double t) {
+            sim.Now = t;
+            if (sim.counter_rng) {
+                Philox4x32 gen(sim.rng_key, sim.rng_counter++);
+                infect(j, gen);
+            } else {
+                CachedBitGenerator cbg(sim.rng, 250);
+                infect(j, cbg);
+            }
+            sim.flush_events();
+        }
+
+        template<typename RNG_T>
+        void infect(size_t j, RNG_T& cbg) {
+            Node* n = sim.nodes[j].get();
+            // introduced unless the contact came from the node's own infectious
+            double local = 0;
+            for (const auto& src : sources[j]) {
+                if (src.first == j) local = src.second * pressure[j];
+            }
+            if (rand_uniform(0, 1, &cbg) * force[j] >= local) n->introduced++;
+            sim.infect(n, cbg);
+            fire_at[j] += rand_exp(1.0, &cbg);
+            set_hazard(j, sim.Now);
+        }
+};
+
+#endif
@@ -0,0 +1,388 @@
+#ifndef NUCOVID_ODE_H
+#define NUCOVID_ODE_H
+
+#include "NUCOVID_tau_leap.h"   // stages shared with the tau-leaping engine
+
+// Variables of one node: S, E, then for each infectious stage and detection
+// flag the number of individuals (N) and the sum of the rates their next
+// contact gap is drawn at (R, see TauCohort), then the absorbing and
+// cumulative counts.
+enum {
+    MF_S,
+    MF_E,
+    MF_N0,                                  // N(stage, det) at MF_N0 + 2*(stage - TL_P) + det
+    MF_R0 = MF_N0 + 2*(TL_STAGES - TL_P),   // R(stage, det) likewise
+    MF_REC = MF_R0 + 2*(TL_STAGES - TL_P),
+    MF_DEA,
+    MF_CUMU_SYM,
+    MF_CUMU_ADM,
+    MF_INTRO,
+    MF_VARS // MF_VARS must be last
+};
+
+// Branching fractions, recomputed once per day.
+enum {
+    MFF_PRES_DET, MFF_PRES_UNDET,   // E -> P, detected or not (times Kpres)
+    MFF_MILD, MFF_SEVERE,           // P -> SM_PRE / SS_PRE
+    MFF_SM_DET, MFF_SM_UNDET,       // SM_PRE -> SM_POST, if undetected so far
+    MFF_SS_DET, MFF_SS_UNDET,
+    MFF_A_DET, MFF_A_UNDET,
+    MFF_CRIT, MFF_NOCRIT,           // SS_POST -> H_CRIT / H_REC
+    MFF_DIE, MFF_SURVIVE,           // H_CRIT -> C_DIE / C_REC
+    MFF_FIELDS // MFF_FIELDS must be last
+};
+
+// Columns of the daily output after node and time, as in print_state().
+enum { MFO_KI, MFO_S, MFO_E, MFO_AP, MFO_SYM, MFO_HOS, MFO_CRIT, MFO_DEA, MFO_R,
+       MFO_CUMU_SYM, MFO_CUMU_ADM, MFO_INTRO, MFO_COLS };
+
+// Parameter sets per MeanField_NUCOVID when running a large batch.
+const size_t MF_BLOCK = 16;
+
+// Mean-field (expected value) version of the model in Event_Driven_NUCOVID,
+// integrated with RK4 for a batch of parameter sets at once.  Every array is
+// laid out [node][field][set], so the innermost loops run over parameter sets
+// with unit stride and one SIMD lane handles one set.
+//
+// The exact engine draws each contact gap at the rate in force at the
+// previous contact, which is tracked here through R; the second moment
+// needed for its renewal is closed with sum(r^2) ~ R^2/N.
+class MeanField_NUCOVID {
+    public:
+        size_t B;                   // parameter sets
+        size_t nn;                  // nodes per set
+        int steps_per_day;
+        double Now;
+        vector<vector<double>> infection_matrix;    // shared by all sets, row-normalized
+        vector<double> x;           // [node][MF_VARS][set]
+        int first_day;
+        vector<double> daily;       // [day - first_day][node][MFO_COLS][set], from integrate_days()
+
+        MeanField_NUCOVID(const vector<vector<shared_ptr<Node>>>& sets, const vector<vector<double>>& mat, int steps = 2) :
+            B(sets.size()), nn(mat.size()), steps_per_day(steps), Now(0), first_day(0), nodes(sets) {
+            infection_matrix = mat;
+            for (size_t i = 0; i < nn; i++) {
+                assert(mat[i].size() == nn);
+                const double row_sum = sum(mat[i]);
+                for (size_t j = 0; j < nn; j++) infection_matrix[i][j] /= row_sum;
+            }
+            x.assign(nn*MF_VARS*B, 0.0);
+            Ninv.resize(nn*B);
+            for (size_t b = 0; b < B; b++) {
+                assert(sets[b].size() == nn);
+                for (size_t i = 0; i < nn; i++) {
+                    x[(i*MF_VARS + MF_S)*B + b] = sets[b][i]->N;
+                    Ninv[i*B + b] = 1.0 / sets[b][i]->N;
+                }
+            }
+            k1.resize(x.size());
+            k2.resize(x.size());
+            k3.resize(x.size());
+            k4.resize(x.size());
+            tmp.resize(x.size());
+            kout.resize(nn*TL_STAGES*B);
+            renew.resize(nn*TL_STAGES*2*B);
+            frac.resize(nn*MFF_FIELDS*B);
+            rate.resize(nn*B);
+            force.resize(nn*B);
+        }
+
+        // move count individuals of node i from S to E in every set
+        void infect(size_t i, double count) {
+            for (size_t b = 0; b < B; b++) {
+                x[(i*MF_VARS + MF_S)*B + b] -= count;
+                x[(i*MF_VARS + MF_E)*B + b] += count;
+            }
+        }
+
+        // Integrate from Now to Now + duration, recording the state at every
+        // whole day in daily.
+        void integrate_days(double duration) {
+            const double end_time = Now + duration;
+            first_day = ceil(Now);
+            const int last_day = floor(end_time);
+            for (size_t b = 0; b < B; b++) {
+                for (size_t i = 0; i < nn; i++) {
+                    Node* n = nodes[b][i].get();
+                    if (n->days() < (size_t) last_day + 1) n->build_day_params(last_day + 1);
+                }
+            }
+            daily.resize((last_day - first_day + 1)*nn*MFO_COLS*B);
+
+            int day = first_day;
+            if (Now < day) integrate(Now, day);
+            record(day);
+            while (day < last_day) {
+                integrate(day, day + 1);
+                day++;
+                record(day);
+            }
+            if (Now < end_time) integrate(Now, end_time);
+        }
+
+        // One print_state() style table per parameter set.
+        vector<vector<string>> run_simulation(double duration) {
+            integrate_days(duration);
+            vector<vector<string>> out(B);
+            for (size_t b = 0; b < B; b++) out[b] = daily_output(b);
+            return out;
+        }
+
+        vector<string> daily_output(size_t b) const {
+            vector<string> out;
+            out.push_back("node\ttime\tKi\tS\tE\tAP\tSYM\tHOS\tCRIT\tDEA\tR\tcumu_sym\tcumu_adm\tintroduced");
+            const size_t ndays = daily.size() / (nn*MFO_COLS*B);
+            char buf[512];
+            for (size_t d = 0; d < ndays; d++) {
+                for (size_t i = 0; i < nn; i++) {
+                    const double* v = &daily[(d*nn + i)*MFO_COLS*B + b];
+                    char* p = buf + snprintf(buf, sizeof(buf), "%d\t%d\t%.5g", nodes[b][i]->id, first_day + (int) d, v[MFO_KI*B]);
+                    for (int c = MFO_S; c < MFO_COLS; c++) {
+                        *p++ = '\t';
+                        p = format_fixed2(p, v[c*B]);
+                    }
+                    out.push_back(string(buf, p));
+                }
+            }
+            return out;
+        }
+
+    private:
+        vector<vector<shared_ptr<Node>>> nodes;
+        vector<double> Ninv;        // [node][set], 1/N
+        vector<double> k1, k2, k3, k4, tmp;     // RK4 stages
+        // per-day tables, from prepare_day()
+        vector<double> kout;        // [node][stage][set], rate of leaving the stage
+        vector<double> renew;       // [node][stage][det][set], Ki times the stage's infectiousness multiplier
+        vector<double> frac;        // [node][MFF_FIELDS][set]
+        // scratch for derivatives(), [node][set]
+        vector<double> rate;        // contact rate of the node's infectious
+        vector<double> force;
+
+        // printf("%.2f") for the counts, which snprintf spends most of the output time on
+        static char* format_fixed2(char* p, double v) {
+            if (!(fabs(v) < 1e15)) return p + snprintf(p, 64, "%.2f", v);
+            long long c = llround(fabs(v) * 100);
+            if (v < 0) *p++ = '-';
+            char digits[24];
+            int n = 0;
+            do {
+                digits[n++] = '0' + c % 10;
+                c /= 10;
+            } while (n < 3 or c > 0);
+            while (n > 2) *p++ = digits[--n];
+            *p++ = '.';
+            *p++ = digits[1];
+            *p++ = digits[0];
+            return p;
+        }
+
+        static int nvar(int s, bool det) { return MF_N0 + 2*(s - TL_P) + det; }
+        static int rvar(int s, bool det) { return MF_R0 + 2*(s - TL_P) + det; }
+
+        const double* fr(size_t i, int f) const { return &frac[(i*MFF_FIELDS + f)*B]; }
+        const double* exit_rate(size_t i, int s) const { return &kout[(i*TL_STAGES + s)*B]; }
+        const double* now_rate(size_t i, int s, bool det) const { return &renew[((i*TL_STAGES + s)*2 + det)*B]; }
+
+        void prepare_day(int day) {
+            for (size_t i = 0; i < nn; i++) {
+                for (size_t b = 0; b < B; b++) {
+                    const Node* n = nodes[b][i].get();
+                    const DayParams& p = n->on_day(day);
+                    const double k[TL_STAGES] = {
+                        n->Kpres + n->Kasym, n->Kmild + n->Ksevere, n->Kdetect[1], p.Krec_mild_adj,
+                        n->Kdetect[2], n->Khosp_adj, p.Krec[2], n->Kcrit, p.Krec[3], n->Kdeath, p.Krec[4],
+                        n->Kdetect[0], p.Krec_asym_adj
+                    };
+                    const double f[MFF_FIELDS] = {
+                        p.Pdet[1] * n->Kpres, (1 - p.Pdet[1]) * n->Kpres,
+                        n->Kmild / k[TL_P], n->Ksevere / k[TL_P],
+                        p.Pdet[2], 1 - p.Pdet[2], p.Pdet[3], 1 - p.Pdet[3], p.Pdet[0], 1 - p.Pdet[0],
+                        p.Pcrit, 1 - p.Pcrit, p.Pdeath, 1 - p.Pdeath
+                    };
+                    for (int s = 0; s < TL_STAGES; s++) {
+                        kout[(i*TL_STAGES + s)*B + b] = k[s];
+                        for (int d = 0; d < 2; d++) {
+                            // as TauLeap_NUCOVID::infectiousness()
+                            double mod = 1;
+                            if (s == TL_A_PRE) mod = n->frac_infectiousness_As;
+                            else if (d) mod = n->frac_infectiousness_det;
+                            else if (s == TL_A_POST) mod = n->frac_infectiousness_As;
+                            renew[((i*TL_STAGES + s)*2 + d)*B + b] = p.Ki * mod;
+                        }
+                    }
+                    for (int c = 0; c < MFF_FIELDS; c++) frac[(i*MFF_FIELDS + c)*B + b] = f[c];
+                }
+            }
+        }
+
+        // RK4 from t0 to t1, within one day so the day's parameters hold
+        void integrate(double t0, double t1) {
+            prepare_day((int) t0);
+            const double dt = 1.0 / steps_per_day;
+            const size_t len = x.size();
+            double* __restrict X = &x[0];
+            double* __restrict K1 = &k1[0];
+            double* __restrict K2 = &k2[0];
+            double* __restrict K3 = &k3[0];
+            double* __restrict K4 = &k4[0];
+            double* __restrict T = &tmp[0];
+            for (double t = t0; t < t1 - 1e-12; t += dt) {
+                const double h = min(dt, t1 - t);
+                derivatives(x, k1);
+                for (size_t v = 0; v < len; v++) T[v] = X[v] + 0.5 * h * K1[v];
+                derivatives(tmp, k2);
+                for (size_t v = 0; v < len; v++) T[v] = X[v] + 0.5 * h * K2[v];
+                derivatives(tmp, k3);
+                for (size_t v = 0; v < len; v++) T[v] = X[v] + h * K3[v];
+                derivatives(tmp, k4);
+                for (size_t v = 0; v < len; v++) X[v] += h / 6.0 * (K1[v] + 2*K2[v] + 2*K3[v] + K4[v]);
+            }
+            Now = t1;
+        }
+
+        void record(int day) {
+            for (size_t i = 0; i < nn; i++) {
+                double* out = &daily[((day - first_day)*nn + i)*MFO_COLS*B];
+                const double* v = &x[i*MF_VARS*B];
+                for (size_t b = 0; b < B; b++) {
+                    double stage[TL_STAGES] = {0};
+                    for (int s = TL_P; s < TL_STAGES; s++) stage[s] = v[nvar(s, false)*B + b] + v[nvar(s, true)*B + b];
+                    out[MFO_KI*B + b] = nodes[b][i]->on_day(day).Ki;
+                    out[MFO_S*B + b] = v[MF_S*B + b];
+                    out[MFO_E*B + b] = v[MF_E*B + b];
+                    out[MFO_AP*B + b] = stage[TL_A_PRE] + stage[TL_A_POST] + stage[TL_P];
+                    out[MFO_SYM*B + b] = stage[TL_SM_PRE] + stage[TL_SM_POST] + stage[TL_SS_PRE] + stage[TL_SS_POST];
+                    out[MFO_HOS*B + b] = stage[TL_H_REC] + stage[TL_H_CRIT] + stage[TL_HPC];
+                    out[MFO_CRIT*B + b] = stage[TL_C_REC] + stage[TL_C_DIE];
+                    out[MFO_DEA*B + b] = v[MF_DEA*B + b];
+                    out[MFO_R*B + b] = v[MF_REC*B + b];
+                    out[MFO_CUMU_SYM*B + b] = v[MF_CUMU_SYM*B + b];
+                    out[MFO_CUMU_ADM*B + b] = v[MF_CUMU_ADM*B + b];
+                    out[MFO_INTRO*B + b] = v[MF_INTRO*B + b];
+                }
+            }
+        }
+
+        void derivatives(const vector<double>& y, vector<double>& dy) {
+            // contact rate of each node's infectious, and the force of infection on each node
+            for (size_t i = 0; i < nn; i++) {
+                const double* __restrict Y = &y[i*MF_VARS*B];
+                double* __restrict r = &rate[i*B];
+                for (size_t b = 0; b < B; b++) {
+                    double sum = 0;
+                    for (int v = MF_R0; v < MF_REC; v++) sum += Y[v*B + b];
+                    r[b] = sum;
+                }
+            }
+            std::fill(force.begin(), force.end(), 0.0);
+            for (size_t i = 0; i < nn; i++) {
+                for (size_t j = 0; j < nn; j++) {
+                    const double m = infection_matrix[i][j];
+                    if (m == 0) continue;
+                    const double* __restrict r = &rate[i*B];
+                    double* __restrict f = &force[j*B];
+                    for (size_t b = 0; b < B; b++) f[b] += m * r[b];
+                }
+            }
+
+            // one pass per node, each lane loading its state once
+            for (size_t i = 0; i < nn; i++) {
+                const double* __restrict Y = &y[i*MF_VARS*B];
+                double* __restrict D = &dy[i*MF_VARS*B];
+                const double* __restrict K = exit_rate(i, 0);
+                const double* __restrict W = now_rate(i, 0, false);
+                const double* __restrict P = fr(i, 0);
+                const double* __restrict F = &force[i*B];
+                const double* __restrict r = &rate[i*B];
+                const double* __restrict Ni = &Ninv[i*B];
+                const double local = infection_matrix[i][i];
+                for (size_t b = 0; b < B; b++) {
+                    double on[TL_STAGES][2], orr[TL_STAGES][2];     // leaving each stage: k*N, k*R
+                    double dn[TL_STAGES][2], dr[TL_STAGES][2];
+                    for (int s = TL_P; s < TL_STAGES; s++) {
+                        const double k = K[s*B + b];
+                        for (int d = 0; d < 2; d++) {
+                            const double n = Y[nvar(s, d)*B + b];
+                            const double R = Y[rvar(s, d)*B + b];
+                            on[s][d] = k * n;
+                            orr[s][d] = k * R;
+                            dn[s][d] = -on[s][d];
+                            // contacts renew the rate to the current one
+                            dr[s][d] = W[(2*s + d)*B + b] * R - R * R / max(n, 1e-12) - orr[s][d];
+                        }
+                    }
+
+                    // infection, and E -> P / A_PRE, which starts the first contact gap
+                    const double S = Y[MF_S*B + b] * Ni[b];
+                    const double E = Y[MF_E*B + b];
+                    const double inf = F[b] * S;
+                    const double pd = P[MFF_PRES_DET*B + b] * E;
+                    const double pu = P[MFF_PRES_UNDET*B + b] * E;
+                    const double asym = K[TL_E*B + b] * E - pd - pu;
+                    dn[TL_P][1] += pd;
+                    dr[TL_P][1] += pd * W[(2*TL_P + 1)*B + b];
+                    dn[TL_P][0] += pu;
+                    dr[TL_P][0] += pu * W[(2*TL_P)*B + b];
+                    dn[TL_A_PRE][0] += asym;
+                    dr[TL_A_PRE][0] += asym * W[(2*TL_A_PRE)*B + b];
+
+                    const double mild = P[MFF_MILD*B + b], severe = P[MFF_SEVERE*B + b];
+                    const double crit = P[MFF_CRIT*B + b], nocrit = P[MFF_NOCRIT*B + b];
+                    const double die = P[MFF_DIE*B + b], survive = P[MFF_SURVIVE*B + b];
+                    const int det_from[3] = {TL_SM_PRE, TL_SS_PRE, TL_A_PRE};
+                    const int det_to[3] = {TL_SM_POST, TL_SS_POST, TL_A_POST};
+                    const int det_f[3] = {MFF_SM_DET, MFF_SS_DET, MFF_A_DET};
+                    double cumu_sym = 0, cumu_adm = 0, dea = 0, rec = 0;
+                    for (int d = 0; d < 2; d++) {
+                        dn[TL_SM_PRE][d] += mild * on[TL_P][d];
+                        dr[TL_SM_PRE][d] += mild * orr[TL_P][d];
+                        dn[TL_SS_PRE][d] += severe * on[TL_P][d];
+                        dr[TL_SS_PRE][d] += severe * orr[TL_P][d];
+                        cumu_sym += mild * on[TL_P][d];
+
+                        dn[TL_H_CRIT][d] += crit * on[TL_SS_POST][d];
+                        dr[TL_H_CRIT][d] += crit * orr[TL_SS_POST][d];
+                        dn[TL_H_REC][d] += nocrit * on[TL_SS_POST][d];
+                        dr[TL_H_REC][d] += nocrit * orr[TL_SS_POST][d];
+                        cumu_adm += on[TL_SS_POST][d];
+
+                        dn[TL_C_DIE][d] += die * on[TL_H_CRIT][d];
+                        dr[TL_C_DIE][d] += die * orr[TL_H_CRIT][d];
+                        dn[TL_C_REC][d] += survive * on[TL_H_CRIT][d];
+                        dr[TL_C_REC][d] += survive * orr[TL_H_CRIT][d];
+                        dn[TL_HPC][d] += on[TL_C_REC][d];
+                        dr[TL_HPC][d] += orr[TL_C_REC][d];
+
+                        dea += on[TL_C_DIE][d];
+                        rec += on[TL_SM_POST][d] + on[TL_H_REC][d] + on[TL_HPC][d] + on[TL_A_POST][d];
+                    }
+                    // detection: the undetected are detected with the day's probability
+                    for (int x = 0; x < 3; x++) {
+                        const int from = det_from[x], to = det_to[x];
+                        const double det = P[det_f[x]*B + b], undet = P[(det_f[x] + 1)*B + b];
+                        dn[to][1] += on[from][1] + det * on[from][0];
+                        dr[to][1] += orr[from][1] + det * orr[from][0];
+                        dn[to][0] += undet * on[from][0];
+                        dr[to][0] += undet * orr[from][0];
+                    }
+
+                    D[MF_S*B + b] = -inf;
+                    D[MF_E*B + b] = inf - K[TL_E*B + b] * E;
+                    for (int s = TL_P; s < TL_STAGES; s++) {
+                        for (int d = 0; d < 2; d++) {
+                            D[nvar(s, d)*B + b] = dn[s][d];
+                            D[rvar(s, d)*B + b] = dr[s][d];
+                        }
+                    }
+                    D[MF_REC*B + b] = rec;
+                    D[MF_DEA*B + b] = dea;
+                    D[MF_CUMU_SYM*B + b] = cumu_sym;
+                    D[MF_CUMU_ADM*B + b] = cumu_adm;
+                    D[MF_INTRO*B + b] = (F[b] - local * r[b]) * S;
+                }
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,467 @@
+#ifndef NUCOVID_TAU_LEAP_H
+#define NUCOVID_TAU_LEAP_H
+
+#include "NUCOVID_cereal.h"
+
+// Sub-stages of the infection history drawn by Event_Driven_NUCOVID::infect().
+// Every duration there is exponential, so the stage (plus the detection flag)
+// is all the state an individual needs, and whole cohorts can be advanced
+// together with binomial draws.
+typedef enum {
+    TL_E,           // exposed
+    TL_P,           // presymptomatic
+    TL_SM_PRE,      // mild, before detection
+    TL_SM_POST,     // mild, after detection
+    TL_SS_PRE,      // severe, before detection
+    TL_SS_POST,     // severe, after detection
+    TL_H_REC,       // hospitalized, will recover
+    TL_H_CRIT,      // hospitalized, will become critical
+    TL_C_REC,       // critical, will recover
+    TL_C_DIE,       // critical, will die
+    TL_HPC,         // hospitalized post-critical
+    TL_A_PRE,       // asymptomatic, before detection
+    TL_A_POST,      // asymptomatic, after detection
+    TL_STAGES // TL_STAGES must be last
+} tauStageType;
+
+const stateType tl_stage_state[TL_STAGES] = {
+    EXPOSED, PRESYMPTOMATIC, SYMPTOMATIC_MILD, SYMPTOMATIC_MILD, SYMPTOMATIC_SEVERE, SYMPTOMATIC_SEVERE,
+    HOSPITALIZED, HOSPITALIZED, CRITICAL, CRITICAL, HOSPITALIZED_CRIT, ASYMPTOMATIC, ASYMPTOMATIC
+};
+
+// Leaped individuals in one stage that draw the gap to their next contact at
+// the same rate.  The exact engine draws each gap with Ki and the
+// infectiousness multiplier in force at the previous contact, so an
+// individual keeps its old rate until it makes a contact, and the rate is
+// part of its state.
+struct TauCohort {
+    double rate;
+    int count;
+};
+
+// Hybrid engine: runs the exact event-driven simulator while the epidemic is
+// small, and switches to chain-binomial tau-leaping (steps_per_day fixed
+// leaps per day) once the number of active infections reaches leap_above.
+// It switches back below exact_below.  Checks happen at day boundaries.
+//
+// While leaping, individuals infected by the exact engine keep their queued
+// events and are handled exactly; their new infections, and all infections
+// caused by leaped individuals, join the leaped cohorts.  On the way back
+// each leaped individual is turned into an exact one by drawing the rest of
+// its history from its current stage.  Node::state_counts stay correct in
+// both modes, so daily output is the same print_state() table.
+class TauLeap_NUCOVID {
+    public:
+        Event_Driven_NUCOVID& sim;
+        int steps_per_day;
+        int leap_above;             // active infections at which leaping starts
+        int exact_below;            // active infections below which exact simulation resumes
+        bool leaping;
+        vector<vector<vector<TauCohort>>> cohorts;  // leaped individuals, [node][2*stage + detected]
+        vector<int> diverted;       // per node, infections handed over by the exact engine
+
+        TauLeap_NUCOVID(Event_Driven_NUCOVID& s, int steps = 128, int above = 2000, int below = 500) :
+            sim(s), steps_per_day(steps), leap_above(above), exact_below(below), leaping(false) {
+            cohorts.resize(sim.nodes.size(), vector<vector<TauCohort>>(2*TL_STAGES));
+            diverted.resize(sim.nodes.size(), 0);
+        }
+
+        int active_infections() const {
+            int active = 0;
+            for (size_t i = 0; i < sim.nodes.size(); i++) {
+                const vector<int>& sc = sim.nodes[i]->state_counts;
+                for (int s = EXPOSED; s <= CRITICAL; s++) active += sc[s];
+            }
+            return active;
+        }
+
+        // Same day bookkeeping, seeding and output as
+        // Event_Driven_NUCOVID::run_simulation(); identical to it as long as
+        // leap_above is never reached.
+        vector<string> run_simulation(double duration, std::map<double, int> seeds, bool print) {
+            double start_time = sim.Now;
+            double intpart;
+            int day;
+            sim.stopped = false;
+
+            vector<string> out_buffer;
+            string header = "node\ttime\tKi\tS\tE\tAP\tSYM\tHOS\tCRIT\tDEA\tR\tcumu_sym\tcumu_adm\tintroduced";
+            cout << setprecision(3) << fixed;
+            out_buffer.push_back(header);
+            if (print) {cout << header << endl;}
+
+            if ( modf(start_time, &intpart) == 0 ) {
+                day = (int) start_time;
+            } else {
+                day = ceil(start_time);
+            }
+
+            double end_time = start_time + duration + sim.offset;
+            size_t horizon = ceil(end_time) + 1;
+            for (size_t i = 0; i < sim.nodes.size(); i++) {
+                if (sim.nodes[i]->days() < horizon) sim.nodes[i]->build_day_params(horizon);
+            }
+
+            std::cout << "start_time, duration, offset: " << start_time << ", " << duration << ", " << sim.offset << std::endl;
+            size_t n_events = 0;
+            size_t n_leaps = 0;
+            auto wall_start = std::chrono::steady_clock::now();
+            while (true) {
+                if (not leaping) {
+                    double next_event_time = sim.check_next_event_time();
+                    if ( (next_event_time == -1) or (next_event_time >= end_time) ) break;
+                    if (next_event_time > day) {
+                        end_day(day, seeds, &out_buffer, print);
+                        if (sim.stopped) break;
+                        if (active_infections() >= leap_above) leaping = true;  // leap through [day-1, day)
+                        continue;
+                    }
+                    sim.next_event();
+                    n_events++;
+                } else {
+                    double t = day - 1;
+                    if (t >= end_time) break;
+                    double tau = 1.0 / steps_per_day;
+                    for (int step = 0; step < steps_per_day and t < end_time; step++) {
+                        double t_next = min(t + tau, end_time);
+                        n_events += leap(t, t_next);
+                        n_leaps++;
+                        t = t_next;
+                    }
+                    if (t >= end_time) break;
+                    end_day(day, seeds, &out_buffer, print);
+                    if (sim.stopped) break;
+                    if (active_infections() < exact_below) {
+                        sim.Now = day - 1;
+                        materialize();
+                        leaping = false;
+                    }
+                }
+            }
+            if (leaping) {
+                // leave an exact simulator behind, e.g. for checkpointing
+                sim.Now = end_time;
+                materialize();
+                leaping = false;
+            }
+            sim.offset = end_time - sim.Now;
+            std::cout << "duration, now, offset: " << duration << ", " << sim.Now << ", " << sim.offset << std::endl;
+            double wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+            std::cout << "events, leaps, wall time: " << n_events << ", " << n_leaps << ", " << wall_time << std::endl;
+
+            if (not sim.stopped) sim.print_state(&out_buffer, day, print);
+
+            return out_buffer;
+        }
+
+    private:
+        void end_day(int& day, const std::map<double, int>& seeds, vector<string>* out_buffer, bool print) {
+            auto iter = seeds.find(static_cast<double>(day));
+            if (iter != seeds.end()) sim.reseed(iter->second);
+            sim.print_state(out_buffer, day, print);
+            day++;
+        }
+
+        // Advance from t to t_next: first the exact engine's own events in
+        // that window, then one binomial leap for the leaped cohorts.
+        // Returns the number of exact events handled.
+        size_t leap(double t, double t_next) {
+            size_t n_events = 0;
+            sim.divert_infections = &diverted;
+            double next_event_time = sim.check_next_event_time();
+            while ( (next_event_time != -1) and (next_event_time < t_next) ) {
+                sim.next_event();
+                n_events++;
+                next_event_time = sim.check_next_event_time();
+            }
+            sim.divert_infections = NULL;
+            for (size_t i = 0; i < diverted.size(); i++) {
+                add(i, TL_E, false, 0, diverted[i]);    // already moved S -> E by the exact engine
+                diverted[i] = 0;
+            }
+
+            sim.Now = t;
+            if (sim.counter_rng) {
+                Philox4x32 gen(sim.rng_key, sim.rng_counter++);
+                leap_cohorts(t_next - t, gen);
+            } else {
+                leap_cohorts(t_next - t, sim.rng);
+            }
+            sim.Now = t_next;
+            return n_events;
+        }
+
+        // infectiousness multiplier of one individual in stage s
+        double infectiousness(const Node* n, int s, bool det) const {
+            if (s == TL_A_PRE) return n->frac_infectiousness_As;
+            if (det) return n->frac_infectiousness_det;
+            return s == TL_A_POST ? n->frac_infectiousness_As : 1;
+        }
+
+        void add(size_t i, int s, bool det, double rate, int k) {
+            if (k == 0) return;
+            vector<TauCohort>& cs = cohorts[i][2*s + det];
+            for (size_t c = 0; c < cs.size(); c++) {
+                if (cs[c].rate == rate) {
+                    cs[c].count += k;
+                    return;
+                }
+            }
+            cs.push_back({rate, k});
+        }
+
+        // k individuals, already taken out of their cohort in stage from
+        void move(Node* n, int from, int to, bool det, double rate, int k) {
+            add(n->id, to, det, rate, k);
+            n->state_counts[tl_stage_state[from]] -= k;
+            n->state_counts[tl_stage_state[to]] += k;
+        }
+
+        // recovery or death, leaving the cohorts
+        void retire(Node* n, int from, stateType to, int k) {
+            n->state_counts[tl_stage_state[from]] -= k;
+            n->state_counts[to] += k;
+        }
+
+        template<typename RNG_T>
+        void leap_cohorts(double tau, RNG_T& rng) {
+            const int day = (int) sim.Now;
+            const size_t nn = sim.nodes.size();
+
+            // Force of infection on each node from the leaped cohorts; the
+            // exact engine picks the target node from the row-normalized
+            // infection_matrix and the contact from the target's N.  Those
+            // that make a contact in this leap take on the current rate.
+            vector<double> force(nn, 0.0);
+            vector<double> local(nn, 0.0);
+            for (size_t i = 0; i < nn; i++) {
+                const Node* src = sim.nodes[i].get();
+                const double Ki = src->on_day(day).Ki;
+                double rate = 0;
+                for (int s = TL_P; s < TL_STAGES; s++) {
+                    for (int d = 0; d < 2; d++) {
+                        vector<TauCohort>& cs = cohorts[i][2*s + d];
+                        const double now = Ki * infectiousness(src, s, d);
+                        int renewed = 0;
+                        for (size_t c = 0; c < cs.size(); c++) {
+                            rate += cs[c].count * cs[c].rate;
+                            if (cs[c].rate == now) continue;
+                            int k = rand_binomial(cs[c].count, 1 - exp(-cs[c].rate * tau), &rng);
+                            cs[c].count -= k;
+                            renewed += k;
+                        }
+                        add(i, s, d, now, renewed);
+                    }
+                }
+                if (rate == 0) continue;
+                const double row_sum = sum(sim.infection_matrix[i]);
+                for (size_t j = 0; j < nn; j++) {
+                    const double f = rate * sim.infection_matrix[i][j] / row_sum;
+                    force[j] += f;
+                    if (i == j) local[j] = f;
+                }
+            }
+
+            for (size_t i = 0; i < nn; i++) {
+                Node* n = sim.nodes[i].get();
+                const DayParams& p = n->on_day(day);
+                const double rates[TL_STAGES] = {
+                    n->Kpres + n->Kasym, n->Kmild + n->Ksevere, n->Kdetect[1], p.Krec_mild_adj,
+                    n->Kdetect[2], n->Khosp_adj, p.Krec[2], n->Kcrit, p.Krec[3], n->Kdeath, p.Krec[4],
+                    n->Kdetect[0], p.Krec_asym_adj
+                };
+
+                // draw every transition from the counts at the start of the leap
+                vector<vector<TauCohort>> leave(2*TL_STAGES);
+                for (int s = 0; s < TL_STAGES; s++) {
+                    const double prob = 1 - exp(-rates[s] * tau);
+                    for (int d = 0; d < 2; d++) {
+                        vector<TauCohort>& cs = cohorts[i][2*s + d];
+                        for (size_t c = 0; c < cs.size(); c++) {
+                            int k = rand_binomial(cs[c].count, prob, &rng);
+                            if (k == 0) continue;
+                            cs[c].count -= k;
+                            leave[2*s + d].push_back({cs[c].rate, k});
+                        }
+                    }
+                }
+
+                const double Ki = p.Ki;
+                for (const TauCohort& c : leave[2*TL_E]) {
+                    // becoming infectious starts the first contact gap
+                    int pres = rand_binomial(c.count, n->Kpres / (n->Kpres + n->Kasym), &rng);
+                    int pres_det = rand_binomial(pres, p.Pdet[1], &rng);
+                    move(n, TL_E, TL_P, true, Ki * infectiousness(n, TL_P, true), pres_det);
+                    move(n, TL_E, TL_P, false, Ki * infectiousness(n, TL_P, false), pres - pres_det);
+                    move(n, TL_E, TL_A_PRE, false, Ki * infectiousness(n, TL_A_PRE, false), c.count - pres);
+                }
+
+                const int det_from[3] = {TL_SM_PRE, TL_SS_PRE, TL_A_PRE};
+                const int det_to[3] = {TL_SM_POST, TL_SS_POST, TL_A_POST};
+                const double det_p[3] = {p.Pdet[2], p.Pdet[3], p.Pdet[0]};
+                for (int d = 0; d < 2; d++) {
+                    for (const TauCohort& c : leave[2*TL_P + d]) {
+                        int mild = rand_binomial(c.count, n->Kmild / (n->Kmild + n->Ksevere), &rng);
+                        move(n, TL_P, TL_SM_PRE, d, c.rate, mild);
+                        move(n, TL_P, TL_SS_PRE, d, c.rate, c.count - mild);
+                        n->cumu_symptomatic += mild;
+                    }
+                    for (int x = 0; x < 3; x++) {
+                        for (const TauCohort& c : leave[2*det_from[x] + d]) {
+                            int det = d ? c.count : rand_binomial(c.count, det_p[x], &rng);
+                            move(n, det_from[x], det_to[x], true, c.rate, det);
+                            move(n, det_from[x], det_to[x], false, c.rate, c.count - det);
+                        }
+                    }
+                    for (const TauCohort& c : leave[2*TL_SS_POST + d]) {
+                        int crit = rand_binomial(c.count, p.Pcrit, &rng);
+                        move(n, TL_SS_POST, TL_H_CRIT, d, c.rate, crit);
+                        move(n, TL_SS_POST, TL_H_REC, d, c.rate, c.count - crit);
+                        n->cumu_admission += c.count;
+                    }
+                    for (const TauCohort& c : leave[2*TL_H_CRIT + d]) {
+                        int die = rand_binomial(c.count, p.Pdeath, &rng);
+                        move(n, TL_H_CRIT, TL_C_DIE, d, c.rate, die);
+                        move(n, TL_H_CRIT, TL_C_REC, d, c.rate, c.count - die);
+                    }
+                    for (const TauCohort& c : leave[2*TL_C_REC + d]) move(n, TL_C_REC, TL_HPC, d, c.rate, c.count);
+                    for (const TauCohort& c : leave[2*TL_C_DIE + d]) retire(n, TL_C_DIE, DEATH, c.count);
+                    for (const TauCohort& c : leave[2*TL_SM_POST + d]) retire(n, TL_SM_POST, RESISTANT, c.count);
+                    for (const TauCohort& c : leave[2*TL_H_REC + d]) retire(n, TL_H_REC, RESISTANT, c.count);
+                    for (const TauCohort& c : leave[2*TL_HPC + d]) retire(n, TL_HPC, RESISTANT, c.count);
+                    for (const TauCohort& c : leave[2*TL_A_POST + d]) retire(n, TL_A_POST, RESISTANT, c.count);
+                }
+
+                // new infections, and how many of them came from other nodes
+                const int S = n->state_counts[SUSCEPTIBLE];
+                if (force[i] > 0 and S > 0) {
+                    int k = rand_binomial(S, 1 - exp(-force[i] / n->N * tau), &rng);
+                    n->state_counts[SUSCEPTIBLE] -= k;
+                    n->state_counts[EXPOSED] += k;
+                    add(i, TL_E, false, 0, k);
+                    n->introduced += rand_binomial(k, 1 - local[i] / force[i], &rng);
+                }
+
+                for (size_t sd = 0; sd < cohorts[i].size(); sd++) {
+                    vector<TauCohort>& cs = cohorts[i][sd];
+                    cs.erase(remove_if(cs.begin(), cs.end(), [](const TauCohort& c) { return c.count == 0; }), cs.end());
+                }
+            }
+        }
+
+        // Hand every leaped individual back to the exact engine at sim.Now.
+        void materialize() {
+            for (size_t i = 0; i < sim.nodes.size(); i++) {
+                Node* n = sim.nodes[i].get();
+                for (int s = 0; s < TL_STAGES; s++) {
+                    for (int d = 0; d < 2; d++) {
+                        for (const TauCohort& c : cohorts[i][2*s + d]) {
+                            for (int k = 0; k < c.count; k++) {
+                                if (sim.counter_rng) {
+                                    Philox4x32 gen(sim.rng_key, sim.rng_counter++);
+                                    resume(n, s, d, c.rate, gen);
+                                } else {
+                                    CachedBitGenerator cbg(sim.rng, 100);
+                                    resume(n, s, d, c.rate, cbg);
+                                }
+                            }
+                        }
+                        cohorts[i][2*s + d].clear();
+                    }
+                }
+            }
+            sim.flush_events();
+        }
+
+        // Draw the rest of the history of one individual now in stage s,
+        // following the same branches as Event_Driven_NUCOVID::infect().
+        // The gap to its first contact is drawn at its cohort's rate.
+        template<typename RNG_T>
+        void resume(Node* n, int s, bool det, double rate, RNG_T& cbg) {
+            if (s == TL_E) {
+                n->state_counts[EXPOSED]--;
+                n->state_counts[SUSCEPTIBLE]++;
+                sim.infect(n, cbg);
+                return;
+            }
+
+            const int id = n->id;
+            double T = sim.Now;
+            double Tr = -1;
+            vector<double> Times;
+            vector<double> Ki_modifier;
+            const double Ki = n->on_day((int) T).Ki;
+            if (rate != Ki * infectiousness(n, s, det) and Ki > 0) {
+                Times.push_back(T);
+                Ki_modifier.push_back(rate / Ki);
+            }
+            while (Tr < 0) {
+                const DayParams& p = n->on_day((int) T);
+                Times.push_back(T);
+                Ki_modifier.push_back(infectiousness(n, s, det));
+                switch (s) {
+                    case TL_P: {
+                        double Tmild = rand_exp(n->Kmild, &cbg);
+                        double Tsevere = rand_exp(n->Ksevere, &cbg);
+                        T += min(Tmild, Tsevere);
+                        sim.add_event(T, Tmild < Tsevere ? SYMM : SYMS, id, id, det);
+                        s = Tmild < Tsevere ? TL_SM_PRE : TL_SS_PRE;
+                        break;
+                    }
+                    case TL_SM_PRE:
+                        T += rand_exp(n->Kdetect[1], &cbg);
+                        if (not det) det = rand_uniform(0, 1, &cbg) < p.Pdet[2];
+                        s = TL_SM_POST;
+                        break;
+                    case TL_SM_POST:
+                        Tr = T + rand_exp(p.Krec_mild_adj, &cbg);
+                        sim.add_event(Tr, RECM, id, id, det);
+                        break;
+                    case TL_SS_PRE:
+                        T += rand_exp(n->Kdetect[2], &cbg);
+                        if (not det) det = rand_uniform(0, 1, &cbg) < p.Pdet[3];
+                        s = TL_SS_POST;
+                        break;
+                    case TL_SS_POST:
+                        T += rand_exp(n->Khosp_adj, &cbg);
+                        sim.add_event(T, HOS, id, id, det);
+                        s = rand_uniform(0, 1, &cbg) > n->on_day((int) T).Pcrit ? TL_H_REC : TL_H_CRIT;
+                        break;
+                    case TL_H_REC:
+                        Tr = T + rand_exp(p.Krec[2], &cbg);
+                        sim.add_event(Tr, RECH, id, id, det);
+                        break;
+                    case TL_H_CRIT:
+                        T += rand_exp(n->Kcrit, &cbg);
+                        sim.add_event(T, CRI, id, id, det);
+                        s = rand_uniform(0, 1, &cbg) > n->on_day((int) T).Pdeath ? TL_C_REC : TL_C_DIE;
+                        break;
+                    case TL_C_REC:
+                        T += rand_exp(p.Krec[3], &cbg);
+                        sim.add_event(T, HPC, id, id, det);
+                        s = TL_HPC;
+                        break;
+                    case TL_HPC:
+                        Tr = T + rand_exp(p.Krec[4], &cbg);
+                        sim.add_event(Tr, RECC, id, id, det);
+                        break;
+                    case TL_C_DIE:
+                        Tr = T + rand_exp(n->Kdeath, &cbg);
+                        sim.add_event(Tr, DEA, id, id, det);
+                        break;
+                    case TL_A_PRE:
+                        T += rand_exp(n->Kdetect[0], &cbg);
+                        if (not det) det = rand_uniform(0, 1, &cbg) < p.Pdet[0];
+                        s = TL_A_POST;
+                        break;
+                    case TL_A_POST:
+                        Tr = T + rand_exp(p.Krec_asym_adj, &cbg);
+                        sim.add_event(Tr, RECA, id, id, det);
+                        break;
+                }
+            }
+            sim.schedule_contacts(n, Times, Ki_modifier, Tr, det, cbg);
+        }
+};
+
+#endif
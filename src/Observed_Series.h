@@ -0,0 +1,95 @@
+#ifndef OBSERVED_SERIES_H
+#define OBSERVED_SERIES_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include "NUCOVID_cereal.h"
+
+using namespace std;
+
+// Observed daily series to fit the model to: a tab-separated table with a
+// header line of "time" and columns of the daily output (e.g. cumu_adm and
+// DEA), one line per day, of the totals over all nodes.  Runs are compared
+// to it day by day as they go (see Event_Driven_NUCOVID::day_check), by
+// ABC_SMC.h's distance or Particle_Filter.h's likelihood.
+class ObservedSeries {
+        vector<int> columns;                // indices into DailyState::counts
+        map<int, vector<double>> values;    // by day, per column
+
+    public:
+        int read(const string& filename) {
+            ifstream file(filename);
+            if (not file.is_open()) {
+                cerr << "Could not open observed series: " << filename << endl;
+                return -1;
+            }
+            string line, name;
+            getline(file, line);
+            stringstream header(line);
+            if (not getline(header, name, '\t') or name != "time") {
+                cerr << "Observed series " << filename << " must start with a time column" << endl;
+                return -1;
+            }
+            while (getline(header, name, '\t')) {
+                int col = -1;
+                for (int c = 0; c < DS_COUNTS; c++) if (DAILY_COLUMN_NAMES[c + 3] == name) col = c;
+                if (col < 0) {
+                    cerr << "Invalid observed column: " << name << " (a count column of the daily output)" << endl;
+                    return -1;
+                }
+                columns.push_back(col);
+            }
+            while (getline(file, line)) {
+                if (line.empty()) continue;
+                stringstream ss(line);
+                int day;
+                vector<double> row(columns.size());
+                ss >> day;
+                for (double& v : row) ss >> v;
+                if (ss.fail()) {
+                    cerr << "Invalid line in observed series " << filename << ": " << line << endl;
+                    return -1;
+                }
+                values[day] = row;
+            }
+            if (columns.empty() or values.empty()) {
+                cerr << "Observed series " << filename << " is empty" << endl;
+                return -1;
+            }
+            return 0;
+        }
+
+        int first_day() const { return values.begin()->first; }
+        int last_day() const { return values.rbegin()->first; }
+        size_t n_columns() const { return columns.size(); }
+        bool observed(int day) const { return values.count(day) > 0; }
+
+        // the observations of day, per column
+        const vector<double>& at(int day) const { return values.at(day); }
+
+        // the observed columns of rows, totalled over the nodes
+        vector<double> simulated(const vector<DailyState>& rows) const {
+            vector<double> totals(columns.size(), 0);
+            for (const DailyState& ds : rows) {
+                for (size_t c = 0; c < columns.size(); c++) totals[c] += ds.counts[columns[c]];
+            }
+            return totals;
+        }
+
+        // squared Euclidean distance of the rows of day, 0 if the day is not
+        // observed
+        double squared_distance(int day, const vector<DailyState>& rows) const {
+            if (not observed(day)) return 0;
+            const vector<double> sim = simulated(rows);
+            const vector<double>& obs = at(day);
+            double d2 = 0;
+            for (size_t c = 0; c < columns.size(); c++) d2 += (sim[c] - obs[c]) * (sim[c] - obs[c]);
+            return d2;
+        }
+};
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef PARTICLE_FILTER_H
+#define PARTICLE_FILTER_H
+
+#include <cmath>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include "NUCOVID_cereal.h"
+#include "Observed_Series.h"
+#include "Work_Stealing_Pool.h"
+
+using namespace std;
+
+// log of the negative binomial probability of y at mean mu and size r
+// (variance mu + mu^2 / r)
+inline double nb_log_likelihood(double y, double mu, double r) {
+    mu = max(mu, 1e-3);         // a particle that saw none of what was observed is unlikely, not impossible
+    return lgamma(y + r) - lgamma(r) - lgamma(y + 1) + r * log(r / (r + mu)) + y * log(mu / (r + mu));
+}
+
+// Bootstrap particle filter over whole simulator states.  Each particle is
+// an Event_Driven_NUCOVID that the caller advances a day at a time; on an
+// observed day each is weighted by the likelihood of what was observed
+// since the last observed day, the increments of each column, as negative
+// binomial around the particle's own increments.  The particles are then
+// resampled (systematically) and the survivors duplicated with fork(),
+// which copies nodes, queue and random state in memory, so a duplicate
+// costs about as much as copying the queue.  Every particle is then
+// reseeded, so duplicates go their own ways from there.
+class ParticleFilter {
+        const ObservedSeries& observed;
+        double size;                    // of the negative binomial
+        vector<vector<double>> last;    // per particle, observed columns at the last observed day
+        vector<double> last_observed;
+
+    public:
+        vector<Event_Driven_NUCOVID> particles;
+        double log_likelihood;          // marginal, of the observations so far
+        size_t clones;                  // made by resampling so far
+
+        ParticleFilter(const ObservedSeries& obs, double nb_size, vector<Event_Driven_NUCOVID>& ps) :
+            observed(obs), size(nb_size), last(ps.size(), vector<double>(obs.n_columns(), 0)),
+            last_observed(obs.n_columns(), 0), log_likelihood(0), clones(0) {
+            particles.swap(ps);
+        }
+
+        // the rows of particle i's daily output for day
+        vector<DailyState> rows(size_t i, int day) const {
+            vector<DailyState> r;
+            for (size_t n = 0; n < particles[i].nodes.size(); n++) r.push_back(particles[i].daily_state(n, day));
+            return r;
+        }
+
+        // Weight the particles by the observations of day, resample them and
+        // reseed particle i with seed(i).  Returns the effective sample size
+        // before resampling.
+        double assimilate(int day, mt19937& rng, unsigned nthreads, const function<int(size_t i)>& seed) {
+            const size_t n = particles.size();
+            const vector<double>& obs = observed.at(day);
+            vector<double> log_w(n);
+            vector<vector<double>> current(n);
+            parallel_for_stealing(n, nthreads, [&](size_t i, unsigned) {
+                current[i] = observed.simulated(rows(i, day));
+                log_w[i] = 0;
+                for (size_t c = 0; c < obs.size(); c++) {
+                    const double y = max(0.0, obs[c] - last_observed[c]);
+                    log_w[i] += nb_log_likelihood(y, current[i][c] - last[i][c], size);
+                }
+            });
+            const double top = *max_element(log_w.begin(), log_w.end());
+            vector<double> w(n);
+            double total = 0;
+            for (size_t i = 0; i < n; i++) total += w[i] = exp(log_w[i] - top);
+            double sum_sq = 0;
+            for (double& x : w) {
+                x /= total;
+                sum_sq += x * x;
+            }
+            log_likelihood += top + log(total / n);
+
+            // systematic resampling: ancestors[j] for the n points (u + j) / n
+            vector<size_t> ancestors(n);
+            const double u = uniform_real_distribution<double>(0, 1)(rng);
+            double cumulative = w[0];
+            for (size_t j = 0, i = 0; j < n; j++) {
+                while ((u + j) / n > cumulative and i + 1 < n) cumulative += w[++i];
+                ancestors[j] = i;
+            }
+            // the first copy of each ancestor is the particle itself, moved
+            vector<char> moved(n, 0);
+            vector<char> first(n, 0);
+            for (size_t j = 0; j < n; j++) {
+                if (not moved[ancestors[j]]) first[j] = moved[ancestors[j]] = 1;
+            }
+            for (auto& p : particles) p.flush_events();     // fork() only reads them after this
+            vector<Event_Driven_NUCOVID> next(n);
+            vector<vector<double>> next_last(n);
+            parallel_for_stealing(n, nthreads, [&](size_t j, unsigned) {
+                if (not first[j]) next[j] = particles[ancestors[j]].fork();
+            });
+            for (size_t j = 0; j < n; j++) {
+                if (first[j]) next[j] = std::move(particles[ancestors[j]]);
+                else clones++;
+                next_last[j] = current[ancestors[j]];
+                next[j].reseed(seed(j));
+            }
+            particles.swap(next);
+            last.swap(next_last);
+            last_observed = obs;
+            return 1 / sum_sq;
+        }
+};
+
+#endif
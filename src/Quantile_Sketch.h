@@ -0,0 +1,122 @@
+#ifndef QUANTILE_SKETCH_H
+#define QUANTILE_SKETCH_H
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <cereal/types/vector.hpp>
+
+using namespace std;
+
+// Mergeable streaming quantiles after Karnin, Lang and Liberty (KLL).
+// Values are held in levels of compactors, a value on level h standing for
+// 2^h of them; when the sketch is over its capacity, the lowest level over
+// its own is sorted and every other value moves up a level.  Up to k values
+// nothing is compacted and quantiles are exact, as R's quantile() (type 7)
+// gives them; beyond that the rank error is about 1.7/k, in O(k) memory
+// however many values are added.  Which half moves up alternates instead
+// of being random, so the result depends only on the order values (and
+// other sketches) arrive in.
+class QuantileSketch {
+        int k;
+        vector<vector<double>> levels;
+        vector<char> odd;       // per level, which half moves up next
+        uint64_t n;             // values added
+        size_t held;
+        size_t limit;           // sum of the levels' capacities
+
+        // the top level holds k, each level below 2/3 of the one above
+        size_t capacity(size_t h) const {
+            const size_t depth = levels.size() - 1 - h;
+            return max<size_t>(2, ceil(k * pow(2.0/3.0, depth)));
+        }
+
+        void add_level() {
+            levels.push_back(vector<double>());
+            odd.push_back(0);
+            limit = 0;
+            for (size_t h = 0; h < levels.size(); h++) limit += capacity(h);
+        }
+
+        void compress() {
+            while (held > limit) {
+                size_t h = 0;
+                while (levels[h].size() < capacity(h)) h++;     // one is over, as held > limit
+                if (h + 1 == levels.size()) add_level();
+                vector<double>& L = levels[h];
+                sort(L.begin(), L.end());
+                const size_t m = L.size() / 2 * 2;              // an odd one out stays
+                for (size_t i = odd[h]; i < m; i += 2) levels[h + 1].push_back(L[i]);
+                odd[h] ^= 1;
+                L.erase(L.begin(), L.begin() + m);
+                held -= m / 2;
+            }
+        }
+
+    public:
+        template<class Archive>
+        void serialize(Archive & archive) {
+            archive( k, levels, odd, n, held, limit );
+        }
+
+        QuantileSketch(int k_ = 200) : k(max(k_, 2)), n(0), held(0), limit(0) {
+            add_level();
+        }
+
+        uint64_t count() const { return n; }
+
+        // whether quantiles are exact, i.e. nothing has been compacted
+        bool exact() const { return levels.size() == 1; }
+
+        void add(double x) {
+            levels[0].push_back(x);
+            n++;
+            if (++held > limit) compress();
+        }
+
+        // add the values in other, which must have the same k
+        void merge(const QuantileSketch& other) {
+            while (levels.size() < other.levels.size()) add_level();
+            for (size_t h = 0; h < other.levels.size(); h++) {
+                levels[h].insert(levels[h].end(), other.levels[h].begin(), other.levels[h].end());
+            }
+            n += other.n;
+            held += other.held;
+            compress();
+        }
+
+        // quantiles at probabilities ps, NAN if nothing was added
+        vector<double> quantiles(const vector<double>& ps) const {
+            vector<double> q(ps.size(), NAN);
+            if (n == 0) return q;
+            if (exact()) {
+                vector<double> L = levels[0];
+                sort(L.begin(), L.end());
+                for (size_t i = 0; i < ps.size(); i++) {
+                    const double h = (L.size() - 1) * ps[i];
+                    const size_t lo = floor(h);
+                    const size_t hi = ceil(h);
+                    q[i] = L[lo] + (h - lo) * (L[hi] - L[lo]);
+                }
+                return q;
+            }
+            vector<pair<double, uint64_t>> weighted;        // (value, weight)
+            weighted.reserve(held);
+            for (size_t h = 0; h < levels.size(); h++) {
+                for (double x : levels[h]) weighted.push_back(make_pair(x, (uint64_t) 1 << h));
+            }
+            sort(weighted.begin(), weighted.end());
+            for (size_t i = 0; i < ps.size(); i++) {
+                // first value whose cumulative weight reaches the rank
+                const double rank = ps[i] * n;
+                uint64_t cumulative = 0;
+                size_t j = 0;
+                while (j + 1 < weighted.size() and cumulative + weighted[j].second < rank) cumulative += weighted[j++].second;
+                q[i] = weighted[j].first;
+            }
+            return q;
+        }
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Utility.h"
+
+// A directory of finished outputs, each named by a key of everything that
+// produced it (see result_key() in chicago_yr1).  Outputs are copied in and
+// out whole.  When the directory grows past max_bytes, the outputs used
+// least recently (by modification time, which fetch() updates) are removed.
+// Several processes may share the directory: entries appear by rename, and
+// one removed under a reader is just a miss.
+class ResultCache {
+        string dir;
+        uint64_t max_bytes;
+
+        static bool copy_file(const string& from, const string& to) {
+            ifstream in(from, ios::binary);
+            if (not in.is_open()) return false;
+            // a name of its own, as other processes may be copying to the same place
+            string tmp = to + ".XXXXXX";
+            const int fd = mkstemp(&tmp[0]);
+            if (fd < 0) return false;
+            fchmod(fd, 0644);
+            close(fd);
+            ofstream out(tmp, ios::binary);
+            out << in.rdbuf();
+            out.close();
+            if (out.fail() or rename(tmp.c_str(), to.c_str()) != 0) {
+                remove(tmp.c_str());
+                return false;
+            }
+            return true;
+        }
+
+        void evict() {
+            DIR* d = opendir(dir.c_str());
+            if (d == NULL) return;
+            vector<pair<time_t, pair<uint64_t, string>>> entries;     // (last used, (bytes, path))
+            uint64_t total = 0;
+            while (struct dirent* e = readdir(d)) {
+                const string name = e->d_name;
+                if (name.size() < 4 or name.compare(name.size() - 4, 4, ".out") != 0) continue;
+                struct stat st;
+                const string path = dir + "/" + name;
+                if (stat(path.c_str(), &st) != 0) continue;
+                entries.push_back(make_pair(st.st_mtime, make_pair((uint64_t) st.st_size, path)));
+                total += st.st_size;
+            }
+            closedir(d);
+            if (total <= max_bytes) return;
+            sort(entries.begin(), entries.end());
+            for (size_t i = 0; i < entries.size() and total > max_bytes; i++) {
+                if (remove(entries[i].second.second.c_str()) == 0) total -= entries[i].second.first;
+            }
+        }
+
+    public:
+        ResultCache(const string& d, uint64_t max) : dir(d), max_bytes(max) {
+            mkdir(dir.c_str(), 0755);
+        }
+
+        string path(const string& key) const { return dir + "/" + key + ".out"; }
+
+        // copy the output stored under key to dest, if there is one
+        bool fetch(const string& key, const string& dest) {
+            if (not copy_file(path(key), dest)) return false;
+            utime(path(key).c_str(), NULL);
+            return true;
+        }
+
+        // store the output in src under key
+        void add(const string& key, const string& src) {
+            if (not copy_file(src, path(key))) {
+                cerr << "WARNING: Could not add " << src << " to the result cache " << dir << endl;
+                return;
+            }
+            evict();
+        }
+
+        // hash of the running executable, so that a rebuilt model does not
+        // reuse the outputs of the old one
+        static string build_id() {
+            static string id;
+            if (id.empty()) {
+                ifstream exe("/proc/self/exe", ios::binary);
+                stringstream bytes;
+                bytes << exe.rdbuf();
+                ContentHash h;
+                h.add(bytes.str());
+                id = h.hex();
+            }
+            return id;
+        }
+};
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef STREAM_WRITER_H
+#define STREAM_WRITER_H
+
+#include <cstdio>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "sys/stat.h"
+
+using namespace std;
+
+inline bool fileExists(const std::string& filename) {
+    struct stat buf;
+    return stat(filename.c_str(), &buf) != -1;
+}
+
+// Text output written out as it is produced, a line at a time, through a
+// buffer of a fixed size.  Lines go to filename + ".part", which close()
+// renames to filename, so a run that is killed leaves what it had written
+// in the .part file and an existing filename is only ever replaced whole.
+// With background set, full buffers are written by a thread of their own
+// while the next one fills; at most two buffers are held either way.
+class StreamWriter {
+        string filename;
+        string part_name;
+        ofstream file;
+        size_t capacity;
+        string filling;
+        bool active;            // the file is open
+        bool failed;
+        // background writing
+        bool background;
+        mutex m;
+        condition_variable changed;
+        string flushing;        // being written by the flusher
+        bool closing;
+        thread flusher;
+
+        void write_out(const string& s) {
+            file.write(s.data(), s.size());
+            file.flush();
+            if (file.fail()) failed = true;
+        }
+
+        void flush_loop() {
+            unique_lock<mutex> lock(m);
+            while (true) {
+                changed.wait(lock, [this] { return closing or not flushing.empty(); });
+                if (flushing.empty()) return;
+                lock.unlock();
+                write_out(flushing);
+                lock.lock();
+                flushing.clear();
+                changed.notify_all();
+            }
+        }
+
+        // write out everything and close the .part file
+        void stop() {
+            flush();
+            if (background) {
+                {
+                    lock_guard<mutex> lock(m);
+                    closing = true;
+                }
+                changed.notify_all();
+                flusher.join();
+            }
+            file.close();
+            active = false;
+        }
+
+    public:
+        // An existing filename is kept, with a warning and nothing written,
+        // unless overwrite is set.
+        StreamWriter(const string& fname, bool overwrite, size_t buffer_bytes = 1 << 20, bool background_flush = false) :
+            filename(fname), part_name(fname + ".part"), capacity(buffer_bytes > 0 ? buffer_bytes : 1), active(false),
+            failed(false), background(background_flush), closing(false) {
+            if (fileExists(filename) and not overwrite) {
+                cerr << "WARNING: Daily output file already exists: " << filename << endl << "WARNING: Aborting write.\n";
+                return;
+            }
+            file.open(part_name, ios::binary);
+            if (not file.is_open()) {
+                cerr << "ERROR: Could not open daily buffer file for output: " << filename << endl;
+                exit(-842);
+            }
+            active = true;
+            filling.reserve(capacity);
+            if (background) flusher = thread(&StreamWriter::flush_loop, this);
+        }
+
+        StreamWriter(const StreamWriter&) = delete;
+        StreamWriter& operator=(const StreamWriter&) = delete;
+
+        // a killed run keeps its .part file, and so does one never closed
+        ~StreamWriter() {
+            if (active) stop();
+        }
+
+        void write(const string& line) {
+            if (not active) return;
+            filling += line;
+            filling += '\n';
+            if (filling.size() >= capacity) flush();
+        }
+
+        // hand the buffered lines to the file
+        void flush() {
+            if (not active or filling.empty()) return;
+            if (not background) {
+                write_out(filling);
+                filling.clear();
+                return;
+            }
+            unique_lock<mutex> lock(m);
+            changed.wait(lock, [this] { return flushing.empty(); });
+            flushing.swap(filling);
+            changed.notify_all();
+        }
+
+        // write out the rest and move the file into place; false if it was
+        // not written or any of it failed
+        bool close() {
+            if (not active) return false;
+            stop();
+            if (failed or rename(part_name.c_str(), filename.c_str()) != 0) {
+                cerr << "ERROR: Could not write daily output file: " << filename << endl;
+                return false;
+            }
+            return true;
+        }
+
+        // drop the output, e.g. of a run that failed
+        void discard() {
+            if (not active) return;
+            stop();
+            remove(part_name.c_str());
+        }
+};
+
+#endif
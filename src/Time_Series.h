@@ -7,7 +7,7 @@ struct TimeSeriesAnchorPoint {
     double value;
 };
 
-vector<double> linInterpolate(double start, double end, size_t n) {
+inline vector<double> linInterpolate(double start, double end, size_t n) {
     // "end" is the value immediately after the sequence produced here
     // e.g. linInterpolate(0.0, 1.0, 5) produces {0.0, 0.2, 0.4, 0.6, 0.8}
     assert(n>=1);
@@ -20,7 +20,7 @@ vector<double> linInterpolate(double start, double end, size_t n) {
     return v;
 }
 
-vector<double> linInterpolateTimeSeries(vector<TimeSeriesAnchorPoint> ap) {
+inline vector<double> linInterpolateTimeSeries(vector<TimeSeriesAnchorPoint> ap) {
     if (ap.size() < 2) {
         cerr << "Must have at least two anchor points." << endl;
         exit(1);
@@ -46,7 +46,7 @@ vector<double> linInterpolateTimeSeries(vector<TimeSeriesAnchorPoint> ap) {
     return v;
 }
 
-vector<double> stepwiseTimeSeries(vector<TimeSeriesAnchorPoint> ap) {
+inline vector<double> stepwiseTimeSeries(vector<TimeSeriesAnchorPoint> ap) {
     if (ap.size() < 2) {
         cerr << "Must have at least two anchor points." << endl;
         exit(1);
@@ -96,7 +96,7 @@ vector<double> gen_trunc_exponential(double lambda, int min, int max) {
 }
 
 
-int rand_nonuniform_int(vector<double> dist, std::mt19937* rng) {
+int rand_nonuniform_int(const vector<double>& dist, std::mt19937* rng) {
     double last = 0;
     double rand = rand_uniform(0, 1, rng);
     for (unsigned int i = 0; i < dist.size(); i++ ) {
@@ -119,6 +119,62 @@ int rand_nonuniform_int(vector<double> dist, std::mt19937* rng) {
 }
 
 
+// O(1) alternative for repeated draws from the same distribution
+int rand_nonuniform_int(const AliasTable& table, std::mt19937* rng) {
+    return table.sample(rng);
+}
+
+
+// Vose's version of Walker's alias method: columns below the mean weight are
+// topped up from a column above it, so each column holds at most two outcomes.
+void AliasTable::build(const vector<double>& weights) {
+    const int n = weights.size();
+    prob.assign(n, 0.0);
+    alias.assign(n, 0);
+    if (n == 0) return;
+
+    double total = 0.0;
+    for (int i = 0; i < n; i++) {
+        if (weights[i] < 0) {
+            cerr << "AliasTable::build() expects non-negative weights\n";
+            exit(1);
+        }
+        total += weights[i];
+    }
+    if (total <= 0) {
+        cerr << "AliasTable::build() expects at least one positive weight\n";
+        exit(1);
+    }
+
+    vector<double> scaled(n);
+    vector<int> small;
+    vector<int> large;
+    for (int i = n - 1; i >= 0; i--) {
+        scaled[i] = weights[i] * n / total;
+        if (scaled[i] < 1.0) {
+            small.push_back(i);
+        } else {
+            large.push_back(i);
+        }
+    }
+
+    while (not small.empty() and not large.empty()) {
+        int s = small.back(); small.pop_back();
+        int l = large.back();
+        prob[s] = scaled[s];
+        alias[s] = l;
+        scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+        if (scaled[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // whatever is left is 1 up to rounding error
+    for (int l : large) { prob[l] = 1.0; alias[l] = l; }
+    for (int s : small) { prob[s] = 1.0; alias[s] = s; }
+}
+
+
 // template<typename RNG_T>
 // int rand_uniform_int (int min, int max, RNG_T* rng) {
 //     // uniform integer on [min, max] (inclusive)
@@ -144,43 +200,6 @@ int rand_nonuniform_int(vector<double> dist, std::mt19937* rng) {
 // }
 
 
-// Devroye's algorithm, as described by Kachitvichyanukul and Schmeiser (1988), 
-// "Binomial random variate generation."  I've correct two mistakes in the publication:
-// the original fails if p = 1, and the conditional for the while loop should be y <= n, 
-// rather than y < n.  The latter precludes ever drawing a deviate of n for p < 1.
-
-// Algorithm BG
-// 1. Set y <-- 0, x <-- 0, c <-- ln(1 - p).
-// 2. If c == 0, return x.
-// 3. Generate u ~ U(0, 1).
-// 4. y <-- y + floor(ln(u)/c) + 1.
-// 5. If y < n, set x <-- x + 1, and goto 3.
-// 6. Return x.
-
-int rand_binomial (int n, double p, std::mt19937* rng) {
-    if ( p == 1.0 ) {
-        return n;
-    } else if ( p == 0.0 or n == 0 ) {
-        return 0;
-    }
-
-    int y = 0;
-    int x = 0;
-    double c = log( 1 - p ); // p can't be 0, but we've already checked that
-
-    while ( y <= n ) {
-        double u = rand_uniform(0, 1, rng);
-        //assert(u > 0.0);
-        y += (int) (log(u)/c) + 1;
-        if (y > n) {
-            return x;
-        }
-        x += 1;
-    }
-    return -1; // bad input was provided
-}
-
-
 // N is the size of the sample space--which includes 0, so the int "N" itself will never get
 // returned in the sample.  sample is an empty vector that needs to be of size k; rng
 // is a Mersenne Twister RNG.
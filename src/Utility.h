@@ -11,17 +11,30 @@
 #include <fstream>
 #include <iostream>
 #include <random>
+#include <cstdint>
 
 using namespace std;
 
 template <typename T> inline T sum(vector<T> list) { T sum=0; for (unsigned int i=0; i<list.size(); i++) sum += list[i]; return sum;}
 template <typename T> inline double mean(vector<T> list) { return (double) sum(list) / list.size(); }
 
+// L[floor(idx)] and L[ceil(idx)] of L sorted, averaged, by partial
+// selection: L[0, end) is reordered so that L[ceil(idx)] is in place and
+// nothing before it is larger.  end must be past ceil(idx).
+template <typename T> inline
+double mid_order_stat(vector<T>& L, float idx, size_t end) {
+    const size_t hi = ceil(idx);
+    const size_t lo = floor(idx);
+    nth_element(L.begin(), L.begin() + hi, L.begin() + end);
+    const T hi_val = L[hi];
+    const T lo_val = lo == hi ? hi_val : *std::max_element(L.begin(), L.begin() + hi);
+    return (hi_val + lo_val) /2.0;
+}
+
 template <typename T> inline
 double median(vector<T> L) { 
-    sort(L.begin(), L.end());
     float idx = (L.size() - 1.0) * 0.5;
-    return ( L[ (int) ceil(idx) ] + L[ (int) floor(idx) ] ) /2.0;
+    return mid_order_stat(L, idx, L.size());
 }
 
 // five number summary (min, 1st quartile, median, 3rd quartile, max)
@@ -29,17 +42,18 @@ template <typename T> inline
 vector<double> fivenum(vector<T> L) {
     assert(L.size() > 2);
     vector<double> stats(5);
-    sort(L.begin(), L.end());
-    stats[0] = L[0];        // min
-    stats[4] = L.back();    // max
+    auto extremes = std::minmax_element(L.begin(), L.end());
+    stats[0] = *extremes.first;     // min
+    stats[4] = *extremes.second;    // max
 
     float idx1 = (L.size() -1) * 0.25;
     float idx2 = (L.size() -1) * 0.5;
     float idx3 = (L.size() -1) * 0.75;
     
-    stats[1] = (L[ceil(idx1)] + L[floor(idx1)]) /2.0;
-    stats[2] = (L[ceil(idx2)] + L[floor(idx2)]) /2.0;
-    stats[3] = (L[ceil(idx3)] + L[floor(idx3)]) /2.0;
+    // each selection leaves the smaller values in front for the next
+    stats[3] = mid_order_stat(L, idx3, L.size());
+    stats[2] = mid_order_stat(L, idx2, (size_t) ceil(idx3) + 1);
+    stats[1] = mid_order_stat(L, idx1, (size_t) ceil(idx2) + 1);
  
     return stats;
 }
@@ -78,7 +92,7 @@ vector<double> gen_trunc_poisson (double lambda, int min, int max);
 vector<double> gen_trunc_exponential (double lambda, int min, int max);
 vector<double> gen_trunc_powerlaw (double alpha, double kappa, int min, int max);
 
-int rand_nonuniform_int (vector<double> dist, mt19937* rng);
+int rand_nonuniform_int (const vector<double>& dist, mt19937* rng);
 
 // int rand_uniform_int (int min, int max, mt19937* rng);
 template<typename RNG_T>
@@ -110,7 +124,78 @@ double rand_exp(double lambda, RNG_T* rng) {
     return -log(dist(*rng)) / lambda; //TODO: could return inf if 0 happens to be returned
 }
 
-int rand_binomial (int n, double p, mt19937* rng);
+// the one binomial sampler, for mt19937 and the counter-based generators
+template<typename RNG_T>
+int rand_binomial(int n, double p, RNG_T* rng) {
+    if (n <= 0 or p <= 0) return 0;
+    if (p >= 1) return n;
+    std::binomial_distribution<int> dist(n, p);
+    return dist(*rng);
+}
+
+// Seed of replicate serial in an ensemble run with the given base seed:
+// SplitMix64 of both, so neighbouring serials get unrelated streams.  Kept
+// non-negative, since -1 means "keep the current seed" in random_seeds.
+inline int replicate_seed(uint32_t seed, uint64_t serial) {
+    uint64_t z = ((uint64_t) seed << 32) + serial + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return (int) ((z ^ (z >> 31)) & 0x7FFFFFFF);
+}
+
+// 64-bit FNV-1a over whatever is added, for naming files by their inputs.
+// Values are hashed by their bytes, so keys are only comparable between
+// builds for the same kind of machine.
+class ContentHash {
+        uint64_t h;
+
+    public:
+        ContentHash() : h(0xCBF29CE484222325ULL) {}
+
+        void add(const void* data, size_t n) {
+            const unsigned char* p = (const unsigned char*) data;
+            for (size_t i = 0; i < n; i++) h = (h ^ p[i]) * 0x100000001B3ULL;
+        }
+        void add(double x) { add(&x, sizeof(x)); }
+        void add(int64_t x) { add(&x, sizeof(x)); }
+        void add(const string& s) { add((int64_t) s.size()); add(s.data(), s.size()); }
+        void add(const vector<double>& v) { add((int64_t) v.size()); add(v.data(), v.size() * sizeof(double)); }
+
+        uint64_t value() const { return h; }
+
+        string hex() const {
+            stringstream ss;
+            ss << std::hex << setw(16) << setfill('0') << h;
+            return ss.str();
+        }
+};
+
+// Walker/Vose alias table: O(n) to build, O(1) per draw from a discrete
+// distribution.  Weights need not be normalized.
+class AliasTable {
+        vector<double> prob;        // probability of keeping column i
+        vector<int> alias;          // index used otherwise
+
+    public:
+        AliasTable() {}
+        AliasTable(const vector<double>& weights) { build(weights); }
+
+        void build(const vector<double>& weights);
+        size_t size() const { return prob.size(); }
+
+        // uses a single uniform draw: integer part picks the column,
+        // fractional part decides between it and its alias
+        template<typename RNG_T>
+        int sample(RNG_T* rng) const {
+            const int n = prob.size();
+            double u = rand_uniform(0, n, rng);
+            int i = (int) u;
+            if (i >= n) i = n - 1;
+            return (u - i) < prob[i] ? i : alias[i];
+        }
+};
+
+int rand_nonuniform_int (const AliasTable& table, mt19937* rng);
 
 void rand_nchoosek(int n, vector<int>& sample, mt19937* rng);
 double normal_pdf(double x, double mu, double var);
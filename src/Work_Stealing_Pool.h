@@ -0,0 +1,57 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <functional>
+
+using namespace std;
+
+// Runs task(i, worker) for every i in [0, n) on nthreads threads (0: one per
+// core).  Each worker starts with a contiguous share of the indices and takes
+// from the front of its own deque; once that is empty it steals from the
+// back of the others', so a few long tasks (e.g. replicates that take off
+// while most go extinct early) do not leave the rest of the threads idle.
+inline void parallel_for_stealing(size_t n, unsigned nthreads, const function<void(size_t, unsigned)>& task) {
+    if (nthreads == 0) nthreads = max(1u, thread::hardware_concurrency());
+    if (nthreads > n) nthreads = max((size_t) 1, n);
+
+    vector<deque<size_t>> work(nthreads);
+    vector<mutex> locks(nthreads);
+    for (size_t i = 0; i < n; i++) work[i * nthreads / n].push_back(i);
+
+    auto worker = [&](unsigned w) {
+        while (true) {
+            size_t i;
+            bool found = false;
+            {
+                lock_guard<mutex> lock(locks[w]);
+                if (not work[w].empty()) {
+                    i = work[w].front();
+                    work[w].pop_front();
+                    found = true;
+                }
+            }
+            for (unsigned v = 1; v < nthreads and not found; v++) {
+                const unsigned victim = (w + v) % nthreads;
+                lock_guard<mutex> lock(locks[victim]);
+                if (not work[victim].empty()) {
+                    i = work[victim].back();
+                    work[victim].pop_back();
+                    found = true;
+                }
+            }
+            if (not found) return;  // nothing is ever added, so everything is taken
+            task(i, w);
+        }
+    };
+
+    vector<thread> threads;
+    for (unsigned w = 1; w < nthreads; w++) threads.push_back(thread(worker, w));
+    worker(0);
+    for (auto& t : threads) t.join();
+}
+
+#endif